@@ -1,9 +1,22 @@
 #include <Arduino.h>
 #include "SWDStream.h"
+#include "SWDSnapshot.h"
 
 SWDStream logger;
 
+// Read with monitor --snapshot
+struct Status
+{
+    uint32_t counter;
+    uint32_t time;
+    int16_t lastKey;
+    uint8_t led;
+};
+
+SWDSnapshot<Status> status(1);
+
 uint32_t counter;
+int16_t lastKey = -1;
 
 void setup()
 {
@@ -28,7 +41,15 @@ void loop()
     {
         logger.print("Received key ");
         logger.println(c);
+        lastKey = c;
     }
+
+    Status s;
+    s.counter = counter;
+    s.time = millis();
+    s.lastKey = lastKey;
+    s.led = digitalRead(LED_BUILTIN);
+    status.publish(s);
     
     delay(100);
 }
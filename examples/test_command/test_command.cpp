@@ -1,6 +1,7 @@
 #include <Arduino.h>
 #include "SWDStream.h"
 #include "CommandParser.h"
+#include "TypedCommand.h"
 
 #define VERSION "1.0"
 
@@ -21,10 +22,61 @@ bool version_cmd(CommandParser *c)
     return true;
 }
 
+bool stats_cmd(CommandParser *c)
+{
+    c->showStats();
+#if SWD_PROFILE
+    c->showProfile();
+#endif
+
+    return true;
+}
+
+bool add_cmd(CommandParser *c, long a, long b)
+{
+    c->printVar("sum", a + b);
+
+    return true;
+}
+
+// Hex dump of memory paced to what the host reads. Each line is up to 70
+// characters so wait for that much space before starting one
+bool dump_cmd(CommandParser *c, Hex addr, int len)
+{
+    if (len <= 0)
+        return false;
+
+    const uint8_t *p = (const uint8_t *)addr.value;
+    unsigned long n = len;
+    for (unsigned long i = c->getResumeState(); i < n; i += 16)
+    {
+        if (c->availableForWrite() < 70)
+        {
+            c->suspend(i);
+            return true;
+        }
+
+        c->printHex(addr.value + i, -8, true);
+        c->putChar(':');
+        for (unsigned long j = i; j < i + 16 && j < n; j++)
+        {
+            c->putChar(' ');
+            c->putByteHex(p[j]);
+        }
+        c->printLine();
+    }
+
+    return true;
+}
+
 const Command commands[] =
 {
     { "help", 0, help_cmd, "Show help on all commands" },
     { "version", 0, version_cmd, "Show the firmware version" },
+    { "stats", 0, stats_cmd, "Show parser statistics and cycle counts" },
+    command<add_cmd>("add", "Add two numbers"),
+    command<dump_cmd>("dump", "Hex dump of memory"),
+    { 0, 0, 0, 0 },
 };
 
 CommandParser parser(logger, commands, 0, true);
@@ -38,7 +90,7 @@ void setup()
 
 void loop()
 {
-    if (parser.inputAvailable())
+    if (parser.inputAvailable() || parser.isSuspended())
     {
         digitalWrite(LED_BUILTIN, LOW);
         parser.poll();
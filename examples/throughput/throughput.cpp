@@ -0,0 +1,205 @@
+#include <Arduino.h>
+#include <stdlib.h>
+#include <string.h>
+#include "SWDStream.h"
+
+// Sends a stream of numbered and checksummed records to measure how much
+// the probe can drain. Check the output with monitor --verify. Each record
+// is a line
+//
+//   #ssssssss rrrrrrrr payload cccc
+//
+// where s is the sequence number, r the rate in records per second at the
+// time and c the CRC16 of everything before the space ahead of it, all in
+// hex. The payload is lower case letters padding the line to the size.
+//
+// The rate, size and ramp can be changed at run time by sending lines
+// such as "rate 2000", "size 128" or "ramp 100".
+
+// Records per second or 0 to send as fast as possible
+#ifndef THROUGHPUT_RATE
+#define THROUGHPUT_RATE 1000
+#endif
+
+// Length of each record including the newline
+#ifndef THROUGHPUT_SIZE
+#define THROUGHPUT_SIZE 64
+#endif
+
+// Records per second added each second to find where loss begins
+#ifndef THROUGHPUT_RAMP
+#define THROUGHPUT_RAMP 0
+#endif
+
+#define RECORD_OVERHEAD 25
+#define RECORD_MAX 250
+
+SWDStream logger;
+
+uint32_t sequence;
+uint32_t rate;
+uint32_t size;
+uint32_t ramp;
+uint32_t nextRecord;
+uint32_t nextRamp;
+
+char input[24];
+uint8_t inputPos;
+
+static uint16_t crcUpdate(uint16_t crc, uint8_t data)
+{
+    data ^= crc & 0xff;
+    data ^= data << 4;
+
+    return ((((uint16_t)data << 8) | (crc>>8)) ^ (uint8_t)(data >> 4)
+            ^ ((uint16_t)data << 3));
+}
+
+// Records are formatted straight into the output ring which may wrap
+// part way through
+class RecordWriter
+{
+public:
+    RecordWriter(const SWDSpan &span_)
+        : span(span_),
+          pos(0),
+          crc(0xffff)
+    {
+    }
+
+    void put(char c)
+    {
+        if (pos < span.firstSize)
+            span.first[pos] = c;
+        else
+            span.second[pos - span.firstSize] = c;
+
+        crc = crcUpdate(crc, c);
+        pos++;
+    }
+
+    void putHex(uint32_t v, int digits)
+    {
+        static const char hex[] = "0123456789ABCDEF";
+
+        for (int i = digits - 1; i >= 0; i--)
+            put(hex[(v >> (i * 4)) & 0xf]);
+    }
+
+    uint16_t getCRC() const { return crc; }
+
+protected:
+    const SWDSpan &span;
+    size_t pos;
+    uint16_t crc;
+};
+
+static void sendRecord()
+{
+    SWDSpan span;
+    if (logger.reserve(size, span) < size)
+        return;
+
+    RecordWriter w(span);
+    w.put('#');
+    w.putHex(sequence, 8);
+    w.put(' ');
+    w.putHex(rate, 8);
+    w.put(' ');
+
+    int payload = size - RECORD_OVERHEAD;
+    char c = 'a' + sequence % 26;
+    for (int i = 0; i < payload; i++)
+    {
+        w.put(c);
+        if (++c > 'z')
+            c = 'a';
+    }
+
+    uint16_t crc = w.getCRC();
+    w.put(' ');
+    w.putHex(crc, 4);
+    w.put('\n');
+
+    logger.commit(size);
+    sequence++;
+}
+
+static void processInput()
+{
+    input[inputPos] = '\0';
+    inputPos = 0;
+
+    char *arg = strchr(input, ' ');
+    if (arg == nullptr)
+        return;
+
+    *arg++ = '\0';
+    uint32_t value = strtoul(arg, nullptr, 10);
+
+    if (strcmp(input, "rate") == 0)
+        rate = value;
+    else if (strcmp(input, "size") == 0)
+    {
+        if (value < RECORD_OVERHEAD)
+            value = RECORD_OVERHEAD;
+        if (value > RECORD_MAX)
+            value = RECORD_MAX;
+        size = value;
+    }
+    else if (strcmp(input, "ramp") == 0)
+        ramp = value;
+}
+
+void setup()
+{
+    pinMode(LED_BUILTIN, OUTPUT);
+    digitalWrite(LED_BUILTIN, LOW);
+
+    sequence = 0;
+    rate = THROUGHPUT_RATE;
+    size = THROUGHPUT_SIZE;
+    ramp = THROUGHPUT_RAMP;
+    nextRecord = micros();
+    nextRamp = millis() + 1000;
+    inputPos = 0;
+}
+
+void loop()
+{
+    int c;
+    while ((c = logger.read()) >= 0)
+    {
+        if (c == '\n' || c == '\r')
+        {
+            if (inputPos > 0)
+                processInput();
+        }
+        else if (inputPos < sizeof(input) - 1)
+            input[inputPos++] = c;
+    }
+
+    if ((int32_t)(millis() - nextRamp) >= 0)
+    {
+        rate += ramp;
+        nextRamp += 1000;
+        digitalWrite(LED_BUILTIN, (nextRamp / 1000) % 2);
+    }
+
+    if (rate == 0)
+    {
+        sendRecord();
+        return;
+    }
+
+    uint32_t now = micros();
+    if ((int32_t)(now - nextRecord) < 0)
+        return;
+
+    sendRecord();
+    nextRecord += 1000000 / rate;
+
+    // Do not try to catch up if the rate is more than the CPU can manage
+    if ((int32_t)(now - nextRecord) > 1000000)
+        nextRecord = now;
+}
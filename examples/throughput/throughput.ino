@@ -0,0 +1,3 @@
+// Empty file to work around Arduino automatic function prototype
+// generation as per https://www.gammon.com.au/forum/?id=12625
+// See throughput.cpp
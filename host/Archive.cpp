@@ -0,0 +1,339 @@
+#include "Archive.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+
+#include <zlib.h>
+
+#define CHUNK_HEADER_SIZE 20
+#define INDEX_ENTRY_SIZE 48
+
+// Segments waiting for the writer thread before new ones are dropped
+#define MAX_QUEUED_SEGMENTS 64
+
+// A segment is queued once it is this old, when checked by add() or tick()
+#define MAX_SEGMENT_AGE 60000000ULL
+
+static void put32(uint8_t *p, uint32_t v)
+{
+    for (int i = 0; i < 4; i++)
+        p[i] = v >> (i * 8);
+}
+
+static void put64(uint8_t *p, uint64_t v)
+{
+    for (int i = 0; i < 8; i++)
+        p[i] = v >> (i * 8);
+}
+
+static uint32_t get32(const uint8_t *p)
+{
+    uint32_t v = 0;
+    for (int i = 3; i >= 0; i--)
+        v = (v << 8) | p[i];
+    return v;
+}
+
+static uint64_t get64(const uint8_t *p)
+{
+    uint64_t v = 0;
+    for (int i = 7; i >= 0; i--)
+        v = (v << 8) | p[i];
+    return v;
+}
+
+static uint64_t hostTime()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+ArchiveWriter::ArchiveWriter()
+    : dataFile(nullptr),
+      indexFile(nullptr),
+      segmentSize(1 << 20),
+      stopping(false),
+      dropped(0)
+{
+}
+
+ArchiveWriter::~ArchiveWriter()
+{
+    close();
+}
+
+bool ArchiveWriter::open(const std::string &name)
+{
+    dataFile = fopen(name.c_str(), "ab");
+    if (dataFile == nullptr)
+    {
+        perror(name.c_str());
+        return false;
+    }
+
+    std::string index_name = name + ".idx";
+    indexFile = fopen(index_name.c_str(), "ab");
+    if (indexFile == nullptr)
+    {
+        perror(index_name.c_str());
+        fclose(dataFile);
+        dataFile = nullptr;
+        return false;
+    }
+
+    startSegment();
+    stopping = false;
+    thread = std::thread(&ArchiveWriter::run, this);
+    return true;
+}
+
+void ArchiveWriter::close()
+{
+    if (dataFile == nullptr)
+        return;
+
+    if (!current.data.empty())
+        queueSegment();
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    ready.notify_one();
+    thread.join();
+
+    fclose(dataFile);
+    fclose(indexFile);
+    dataFile = nullptr;
+    indexFile = nullptr;
+}
+
+void ArchiveWriter::startSegment()
+{
+    current.data.clear();
+    current.data.reserve(segmentSize + CHUNK_HEADER_SIZE);
+    memset(&current.entry, 0, sizeof(current.entry));
+}
+
+void ArchiveWriter::add(const uint8_t *data, size_t size, uint64_t targetTime)
+{
+    if (dataFile == nullptr || size == 0)
+        return;
+
+    uint64_t now = hostTime();
+
+    uint8_t header[CHUNK_HEADER_SIZE];
+    put64(header, now);
+    put64(header + 8, targetTime);
+    put32(header + 16, size);
+    current.data.insert(current.data.end(), header, header + sizeof(header));
+    current.data.insert(current.data.end(), data, data + size);
+
+    ArchiveIndexEntry &e = current.entry;
+    if (e.firstHost == 0)
+        e.firstHost = now;
+    e.lastHost = now;
+
+    if (targetTime != 0)
+    {
+        if (e.firstTarget == 0)
+            e.firstTarget = targetTime;
+        e.lastTarget = targetTime;
+    }
+
+    if (current.data.size() >= segmentSize ||
+        now - e.firstHost >= MAX_SEGMENT_AGE)
+        queueSegment();
+}
+
+void ArchiveWriter::tick()
+{
+    if (dataFile != nullptr && !current.data.empty() &&
+        hostTime() - current.entry.firstHost >= MAX_SEGMENT_AGE)
+        queueSegment();
+}
+
+void ArchiveWriter::queueSegment()
+{
+    current.entry.size = current.data.size();
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (queue.size() < MAX_QUEUED_SEGMENTS)
+            queue.push_back(std::move(current));
+        else
+            dropped++;
+    }
+    ready.notify_one();
+
+    startSegment();
+}
+
+void ArchiveWriter::run()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true)
+    {
+        ready.wait(lock, [this]() { return stopping || !queue.empty(); });
+
+        if (queue.empty())
+            break;
+
+        Segment s = std::move(queue.front());
+        queue.pop_front();
+
+        // Compress without holding up add()
+        lock.unlock();
+        writeSegment(s);
+        lock.lock();
+    }
+}
+
+bool ArchiveWriter::writeSegment(Segment &s)
+{
+    uLongf compressed_size = compressBound(s.data.size());
+    std::vector<uint8_t> compressed(compressed_size);
+    if (compress2(compressed.data(), &compressed_size, s.data.data(),
+                  s.data.size(), Z_DEFAULT_COMPRESSION) != Z_OK)
+    {
+        fprintf(stderr, "Archive compression failed\n");
+        return false;
+    }
+
+    fseek(dataFile, 0, SEEK_END);
+    s.entry.offset = ftell(dataFile);
+    s.entry.compressedSize = compressed_size;
+
+    uint8_t entry[INDEX_ENTRY_SIZE];
+    put64(entry, s.entry.offset);
+    put32(entry + 8, s.entry.compressedSize);
+    put32(entry + 12, s.entry.size);
+    put64(entry + 16, s.entry.firstHost);
+    put64(entry + 24, s.entry.lastHost);
+    put64(entry + 32, s.entry.firstTarget);
+    put64(entry + 40, s.entry.lastTarget);
+
+    // The index is written after the data so a reader never sees an entry
+    // for a segment that is not there
+    if (fwrite(compressed.data(), compressed_size, 1, dataFile) != 1 ||
+        fflush(dataFile) != 0 ||
+        fwrite(entry, sizeof(entry), 1, indexFile) != 1 ||
+        fflush(indexFile) != 0)
+    {
+        perror("Archive write");
+        return false;
+    }
+
+    return true;
+}
+
+bool ArchiveReader::open(const std::string &name)
+{
+    dataName = name;
+    index.clear();
+
+    std::string index_name = name + ".idx";
+    FILE *fp = fopen(index_name.c_str(), "rb");
+    if (fp == nullptr)
+    {
+        perror(index_name.c_str());
+        return false;
+    }
+
+    uint8_t buf[INDEX_ENTRY_SIZE];
+    while (fread(buf, sizeof(buf), 1, fp) == 1)
+    {
+        ArchiveIndexEntry e;
+        e.offset = get64(buf);
+        e.compressedSize = get32(buf + 8);
+        e.size = get32(buf + 12);
+        e.firstHost = get64(buf + 16);
+        e.lastHost = get64(buf + 24);
+        e.firstTarget = get64(buf + 32);
+        e.lastTarget = get64(buf + 40);
+        index.push_back(e);
+    }
+
+    fclose(fp);
+    return true;
+}
+
+bool ArchiveReader::readHost(uint64_t from, uint64_t to, Callback cb)
+{
+    // Segments are written in host time order
+    auto it = std::lower_bound(index.begin(), index.end(), from,
+                               [](const ArchiveIndexEntry &e, uint64_t t) {
+                                   return e.lastHost < t;
+                               });
+
+    for (; it != index.end() && it->firstHost <= to; ++it)
+    {
+        if (!readSegment(*it, false, from, to, cb))
+            return false;
+    }
+
+    return true;
+}
+
+bool ArchiveReader::readTarget(uint64_t from, uint64_t to, Callback cb)
+{
+    // The target counter starts again after a reset so check every segment
+    for (const ArchiveIndexEntry &e : index)
+    {
+        if (e.lastTarget == 0 || e.lastTarget < from || e.firstTarget > to)
+            continue;
+
+        if (!readSegment(e, true, from, to, cb))
+            return false;
+    }
+
+    return true;
+}
+
+bool ArchiveReader::readSegment(const ArchiveIndexEntry &e, bool byTarget,
+                                uint64_t from, uint64_t to, Callback cb)
+{
+    FILE *fp = fopen(dataName.c_str(), "rb");
+    if (fp == nullptr)
+    {
+        perror(dataName.c_str());
+        return false;
+    }
+
+    std::vector<uint8_t> compressed(e.compressedSize);
+    bool ok = fseek(fp, e.offset, SEEK_SET) == 0 &&
+        fread(compressed.data(), compressed.size(), 1, fp) == 1;
+    fclose(fp);
+
+    std::vector<uint8_t> data(e.size);
+    uLongf size = data.size();
+    if (!ok || uncompress(data.data(), &size, compressed.data(),
+                          compressed.size()) != Z_OK)
+    {
+        fprintf(stderr, "Archive segment at %llu is damaged\n",
+                (unsigned long long)e.offset);
+        return false;
+    }
+
+    size_t pos = 0;
+    while (pos + CHUNK_HEADER_SIZE <= size)
+    {
+        uint64_t host = get64(&data[pos]);
+        uint64_t target = get64(&data[pos + 8]);
+        uint32_t len = get32(&data[pos + 16]);
+        pos += CHUNK_HEADER_SIZE;
+
+        if (len > size - pos)
+            break;
+
+        uint64_t t = byTarget ? target : host;
+        if (t >= from && t <= to && (!byTarget || target != 0))
+            cb(host, target, &data[pos], len);
+
+        pos += len;
+    }
+
+    return true;
+}
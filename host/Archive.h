@@ -0,0 +1,117 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Console output archive. The data file is a series of independently
+// zlib compressed segments and name.idx holds one entry per segment with
+// its position and the range of host and target times it covers, so a
+// reader only needs to decompress the segments for the times it wants.
+//
+// Each segment holds chunks of output as they were received:
+//
+//   host time    8 bytes, microseconds since the Unix epoch
+//   target time  8 bytes, unwrapped target counter or 0 if not known
+//   size         4 bytes
+//   data         size bytes
+//
+// All values are little endian.
+
+struct ArchiveIndexEntry
+{
+    uint64_t offset;
+    uint32_t compressedSize;
+    uint32_t size;
+    uint64_t firstHost;
+    uint64_t lastHost;
+    uint64_t firstTarget;
+    uint64_t lastTarget;
+};
+
+// Collects output into segments which are compressed and written by a
+// background thread. add() only copies the data so it never waits for
+// compression or the disk. If the writer falls too far behind whole
+// segments are dropped and counted.
+class ArchiveWriter
+{
+public:
+    ArchiveWriter();
+    ~ArchiveWriter();
+
+    // Appends to an existing archive
+    bool open(const std::string &name);
+
+    // Write out what has been collected and stop the thread
+    void close();
+
+    // Uncompressed size of each segment
+    void setSegmentSize(size_t size) { segmentSize = size; }
+
+    void add(const uint8_t *data, size_t size, uint64_t targetTime = 0);
+
+    // Call regularly so the output of a target that has gone quiet is
+    // still written out once its segment is old enough
+    void tick();
+
+    size_t getDropped() const { return dropped; }
+
+protected:
+    struct Segment
+    {
+        std::vector<uint8_t> data;
+        ArchiveIndexEntry entry;
+    };
+
+    FILE *dataFile;
+    FILE *indexFile;
+    size_t segmentSize;
+
+    Segment current;
+
+    std::mutex mutex;
+    std::condition_variable ready;
+    std::deque<Segment> queue;
+    bool stopping;
+    size_t dropped;
+    std::thread thread;
+
+    void startSegment();
+    void queueSegment();
+    void run();
+    bool writeSegment(Segment &s);
+};
+
+// Reads back the output for a range of host or target times
+class ArchiveReader
+{
+public:
+    typedef std::function<void (uint64_t hostTime, uint64_t targetTime,
+                                const uint8_t *data, size_t size)> Callback;
+
+    bool open(const std::string &name);
+
+    // Pass every chunk with a host time in [from, to] to the callback.
+    // Times are microseconds since the Unix epoch
+    bool readHost(uint64_t from, uint64_t to, Callback cb);
+
+    // Same by target time
+    bool readTarget(uint64_t from, uint64_t to, Callback cb);
+
+    const std::vector<ArchiveIndexEntry> &getIndex() const { return index; }
+
+protected:
+    std::string dataName;
+    std::vector<ArchiveIndexEntry> index;
+
+    bool readSegment(const ArchiveIndexEntry &e, bool byTarget,
+                     uint64_t from, uint64_t to, Callback cb);
+};
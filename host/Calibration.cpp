@@ -0,0 +1,219 @@
+#include "Calibration.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+// Slow enough to work with any probe and wiring
+#define REFERENCE_CLOCK 1000
+#define REFERENCE_SIZE 0x2000
+
+// Tried fastest first. The probe uses the nearest rate it supports
+static const int clocks[] = { 24000, 12000, 8000, 4000, 1800, 1000 };
+
+// Larger blocks are only tried if the smaller ones work
+static const size_t blockSizes[] = { 0x400, 0x800, 0x1000, 0x1800 };
+
+Calibration::Calibration(STLink &stlink_)
+    : stlink(stlink_),
+      clock(stlink_.getClock()),
+      maxBlock(stlink_.getMaxBlock()),
+      fixedCost(stlink_.getFixedCost()),
+      byteCost(stlink_.getByteCost())
+{
+}
+
+bool Calibration::verify(int count)
+{
+    size_t flash_base, flash_size;
+    stlink.getFlash(flash_base, flash_size);
+
+    std::string buf(reference.size(), '\0');
+    for (int i = 0; i < count; i++)
+    {
+        if (!stlink.read((uint8_t *)&buf[0], flash_base, buf.size()) ||
+            buf != reference)
+            return false;
+    }
+
+    return true;
+}
+
+// Average time in seconds to read size bytes
+double Calibration::timeRead(size_t size, int count)
+{
+    size_t flash_base, flash_size;
+    stlink.getFlash(flash_base, flash_size);
+
+    std::vector<uint8_t> buf(size);
+    std::chrono::steady_clock::time_point start =
+        std::chrono::steady_clock::now();
+
+    for (int i = 0; i < count; i++)
+        stlink.read(buf.data(), flash_base, size);
+
+    return std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - start).count() / count;
+}
+
+bool Calibration::run()
+{
+    size_t flash_base, flash_size;
+    stlink.getFlash(flash_base, flash_size);
+
+    size_t ref_size = std::min((size_t)REFERENCE_SIZE, flash_size);
+    if (ref_size == 0)
+    {
+        fprintf(stderr, "No flash to calibrate against\n");
+        return false;
+    }
+
+    stlink.setMaxBlock(blockSizes[0]);
+    stlink.setClock(REFERENCE_CLOCK);
+
+    reference.resize(ref_size);
+    if (!stlink.read((uint8_t *)&reference[0], flash_base, ref_size))
+    {
+        fprintf(stderr, "Could not read the flash for calibration\n");
+        return false;
+    }
+
+    clock = REFERENCE_CLOCK;
+    for (int c : clocks)
+    {
+        if (stlink.setClock(c) && verify(3))
+        {
+            clock = c;
+            break;
+        }
+    }
+
+    stlink.setClock(clock);
+
+    // Keep the largest block that works unless it is not noticeably faster
+    double best = 0;
+    maxBlock = blockSizes[0];
+    for (size_t b : blockSizes)
+    {
+        stlink.setMaxBlock(b);
+        if (!verify(2))
+            break;
+
+        double rate = ref_size / timeRead(ref_size, 2);
+        if (rate > best * 1.02)
+        {
+            best = rate;
+            maxBlock = b;
+        }
+    }
+
+    stlink.setMaxBlock(maxBlock);
+
+    // Least squares fit of time = fixed + perByte * size over single
+    // transfers
+    std::vector<size_t> sizes = { 4, 64, 256, 1024, maxBlock };
+    std::vector<double> times;
+    for (size_t &s : sizes)
+    {
+        s = std::min(s, ref_size);
+        times.push_back(timeRead(s, 5));
+    }
+
+    double n = sizes.size();
+    double sx = 0, sy = 0;
+    for (size_t i = 0; i < sizes.size(); i++)
+    {
+        sx += sizes[i];
+        sy += times[i];
+    }
+
+    double mx = sx / n, my = sy / n;
+    double sxx = 0, sxy = 0;
+    for (size_t i = 0; i < sizes.size(); i++)
+    {
+        sxx += (sizes[i] - mx) * (sizes[i] - mx);
+        sxy += (sizes[i] - mx) * (times[i] - my);
+    }
+
+    byteCost = sxx > 0 ? sxy / sxx : 0;
+    fixedCost = my - byteCost * mx;
+
+    // Noise can give nonsense on a very fast or very slow probe
+    byteCost = std::max(byteCost, 1e-9);
+    fixedCost = std::max(fixedCost, 1e-6);
+
+    apply();
+    return true;
+}
+
+std::string Calibration::cacheFile() const
+{
+    std::string dir;
+    const char *xdg = getenv("XDG_CACHE_HOME");
+    const char *home = getenv("HOME");
+    if (xdg != nullptr && *xdg != '\0')
+        dir = xdg;
+    else if (home != nullptr)
+        dir = std::string(home) + "/.cache";
+    else
+        return "";
+
+    return dir + "/swd-monitor/" + stlink.getSerial();
+}
+
+bool Calibration::load()
+{
+    std::string filename = cacheFile();
+    if (filename.empty())
+        return false;
+
+    FILE *fp = fopen(filename.c_str(), "r");
+    if (fp == nullptr)
+        return false;
+
+    bool ok = fscanf(fp, "%d %zu %lf %lf", &clock, &maxBlock, &fixedCost,
+                     &byteCost) == 4;
+    fclose(fp);
+
+    return ok && clock > 0 && maxBlock >= 4 && byteCost > 0;
+}
+
+bool Calibration::save() const
+{
+    std::string filename = cacheFile();
+    if (filename.empty())
+        return false;
+
+    // Create the directories as needed
+    size_t slash = 0;
+    while ((slash = filename.find('/', slash + 1)) != std::string::npos)
+        mkdir(filename.substr(0, slash).c_str(), 0755);
+
+    FILE *fp = fopen(filename.c_str(), "w");
+    if (fp == nullptr)
+    {
+        perror(filename.c_str());
+        return false;
+    }
+
+    fprintf(fp, "%d %zu %.9g %.9g\n", clock, maxBlock, fixedCost, byteCost);
+    return fclose(fp) == 0;
+}
+
+void Calibration::apply()
+{
+    stlink.setClock(clock);
+    stlink.setMaxBlock(maxBlock);
+    stlink.setCosts(fixedCost, byteCost);
+}
+
+void Calibration::print(FILE *fp) const
+{
+    fprintf(fp, "SWD clock %dkHz, blocks of %zu bytes, "
+            "transfer %.1fus + %.3fus/byte\n", clock, maxBlock,
+            fixedCost * 1e6, byteCost * 1e6);
+}
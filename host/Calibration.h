@@ -0,0 +1,45 @@
+#pragma once
+
+#include "STLink.h"
+
+#include <stdio.h>
+
+#include <string>
+
+// Finds the fastest SWD clock and largest transfer that read reliably for
+// a probe and target and measures the cost of transfers. Reads of the
+// start of flash at a slow clock are the reference that faster settings
+// are checked against. The result is cached per probe serial number under
+// $XDG_CACHE_HOME/swd-monitor or ~/.cache/swd-monitor.
+class Calibration
+{
+public:
+    Calibration(STLink &stlink);
+
+    // Try the clock rates and block sizes and fit the cost model
+    bool run();
+
+    bool load();
+    bool save() const;
+
+    // Set the probe to use the results
+    void apply();
+
+    void print(FILE *fp) const;
+
+protected:
+    STLink &stlink;
+
+    int clock;
+    size_t maxBlock;
+    double fixedCost;
+    double byteCost;
+
+    std::string reference;
+
+    std::string cacheFile() const;
+
+    // Read the reference area count times and check it matches
+    bool verify(int count);
+    double timeRead(size_t size, int count);
+};
@@ -0,0 +1,477 @@
+#include "Channel.h"
+
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+
+#include <algorithm>
+
+// Time between scans for lost channels
+#define REATTACH_SCAN_MS 1000
+// Polls retried before reopening the probe after an error
+#define REATTACH_RETRIES 10
+// Time between attempts to reopen the probe
+#define REATTACH_RECONNECT_MS 250
+
+typedef std::chrono::steady_clock Clock;
+
+static void putWord(uint8_t *p, uint32_t v)
+{
+    for (int i = 0; i < 4; i++)
+        p[i] = v >> (i * 8);
+}
+
+Channel::Channel(Probe &probe_, const Location &location)
+    : probe(probe_),
+      address(location.address),
+      magic(location.magic),
+      lost(false),
+      attached(false),
+      resets(0)
+{
+}
+
+std::vector<Channel::Location> Channel::find(Probe &probe)
+{
+    std::vector<Location> res;
+
+    // Search for the magic numbers in the RAM
+    size_t ram_base, ram_size;
+    probe.getRAM(ram_base, ram_size);
+
+    std::vector<uint8_t> ram;
+    ram.resize(ram_size);
+
+    if (!probe.read(ram.data(), ram_base, ram_size))
+    {
+        fprintf(stderr, "Could not read ram\n");
+        return res;
+    }
+
+    for (size_t i = 0; i + 3 < ram_size; i += 4)
+    {
+        uint32_t m;
+        memcpy(&m, &ram[i], sizeof(m));
+        if (m == SWDSTREAM_MAGIC || m == SWDPRINT_MAGIC)
+        {
+            Location l;
+            l.address = ram_base + i;
+            l.magic = m;
+            res.push_back(l);
+        }
+    }
+
+    return res;
+}
+
+bool Channel::getLogMask(uint32_t &mask)
+{
+    uint8_t buf[4];
+    if (!probe.read(buf, address + LOG_MASK_OFFSET, sizeof(buf)))
+        return false;
+
+    mask = buf[0] | (buf[1] << 8) | (buf[2] << 16) | ((uint32_t)buf[3] << 24);
+    return true;
+}
+
+bool Channel::setLogMask(uint32_t mask)
+{
+    // One aligned word so the firmware never sees half of it
+    uint8_t buf[4];
+    putWord(buf, mask);
+    return probe.write(buf, address + LOG_MASK_OFFSET, sizeof(buf));
+}
+
+void Channel::write(const uint8_t *data, size_t size)
+{
+    pending.append((const char *)data, size);
+}
+
+size_t Channel::takeInput(uint8_t *buf, size_t max)
+{
+    // Queued data goes first then anything from the callback
+    size_t count = std::min(max, pending.size());
+    memcpy(buf, pending.data(), count);
+    pending.erase(0, count);
+
+    if (count < max && writeCallback)
+        count += writeCallback(buf + count, max - count);
+
+    return count;
+}
+
+void Channel::receive(const uint8_t *data, size_t size)
+{
+    if (readCallback)
+        readCallback(data, size);
+}
+
+void Channel::reset()
+{
+    resets++;
+    if (resetCallback)
+        resetCallback();
+}
+
+void Channel::relocate(const Location &location)
+{
+    address = location.address;
+    magic = location.magic;
+    attached = false;
+}
+
+int Channel::poll()
+{
+    uint8_t header[HEADER_SIZE];
+    if (!probe.read(header, address, sizeof(header)))
+        return -1;
+
+    return poll(header);
+}
+
+int Channel::poll(const uint8_t *header)
+{
+    uint32_t m;
+    memcpy(&m, header, sizeof(m));
+    if (m != magic)
+    {
+        if (!lost)
+        {
+            lost = true;
+            lostTime = Clock::now();
+        }
+
+        return 0;
+    }
+
+    // The status is out_head, out_tail, in_head, in_tail
+    uint8_t status[4];
+    memcpy(status, header + STATUS_OFFSET, sizeof(status));
+
+    // Only the constructor clears the attach word so finding it clear after
+    // it was set means a restart even if the magic number never went away
+    uint32_t a;
+    memcpy(&a, header + ATTACHED_OFFSET, sizeof(a));
+    bool restarted = lost || (attached && a != ATTACHED);
+    lost = false;
+    if (restarted)
+        reset();
+
+    if (a != ATTACHED)
+    {
+        uint8_t buf[4];
+        putWord(buf, ATTACHED);
+        if (!probe.write(buf, address + ATTACHED_OFFSET, sizeof(buf)))
+            return -1;
+
+        attached = true;
+    }
+
+    bool active = false;
+
+    uint8_t buffer[BUFFER_SIZE];
+    int res = readOutput(status, buffer);
+    if (res < 0)
+        return -1;
+
+    if (res > 0)
+    {
+        if (readCallback)
+            readCallback(buffer, res);
+
+        active = true;
+    }
+
+    if (hasInput())
+    {
+        uint8_t in_free = 255 - (uint8_t)(status[2] - status[3]);
+        size_t count = in_free > 0 ? takeInput(buffer, in_free) : 0;
+        if (count > 0)
+        {
+            if (writeInput(status, buffer, count) < 0)
+                return -1;
+
+            active = true;
+        }
+    }
+
+    return active;
+}
+
+// Read any new output from the target into buffer and update the tail.
+// Returns the number of bytes read or -1 on error
+int Channel::readOutput(uint8_t *status, uint8_t *buffer)
+{
+    uint8_t out_head = status[0];
+    uint8_t out_tail = status[1];
+
+    if (out_head == out_tail)
+        return 0;
+
+    size_t out_buffer_addr = address + OUT_BUFFER_OFFSET;
+
+    int pos = 0;
+    // Writes go to the head and reads from the tail. Data is from the
+    // position after the tail up to and including the head
+    if (out_head > out_tail)
+    {
+        if (!probe.read(buffer, out_buffer_addr + out_tail + 1,
+                         out_head - out_tail))
+            return -1;
+
+        pos = out_head - out_tail;
+    }
+    else if ((size_t)(out_tail - out_head) * probe.getByteCost() <
+             probe.getFixedCost())
+    {
+        // Buffer wrap around. Reading the whole buffer at once is quicker
+        // than two transfers when little of it is not wanted
+        uint8_t whole[BUFFER_SIZE];
+        if (!probe.read(whole, out_buffer_addr, BUFFER_SIZE))
+            return -1;
+
+        pos = 255 - out_tail;
+        memcpy(buffer, whole + out_tail + 1, pos);
+        memcpy(buffer + pos, whole, out_head + 1);
+        pos += out_head + 1;
+    }
+    else
+    {
+        // Buffer wrap around
+        // Read from the buffer before wrap around
+        if (out_tail < 255)
+        {
+            if (!probe.read(buffer, out_buffer_addr + out_tail + 1,
+                             255 - out_tail))
+                return -1;
+
+            pos = 255 - out_tail;
+        }
+
+        // Read rest
+        if (!probe.read(buffer + pos, out_buffer_addr, out_head + 1))
+            return -1;
+
+        pos += out_head + 1;
+    }
+
+    // Update the tail pointer to empty the buffer
+    status[1] = out_head;
+    if (!probe.write(&status[1], getStatusAddress() + 1, 1))
+        return -1;
+
+    return pos;
+}
+
+// Write data into the target input buffer which must have space for it
+// and update the head. Returns the number of bytes written or -1 on error
+int Channel::writeInput(uint8_t *status, const uint8_t *data, int size)
+{
+    uint8_t in_head = status[2];
+    size_t in_buffer_addr = address + IN_BUFFER_OFFSET;
+
+    int count = size;
+    if (in_head + count > 255)
+        count = 255 - in_head;
+
+    // Write as much as possible to the end of the buffer
+    if (count > 0)
+    {
+        if (!probe.write((uint8_t *)data, in_buffer_addr + in_head + 1,
+                          count))
+            return -1;
+
+        in_head += count;
+    }
+
+    // If still more then write at the start of the buffer
+    int rest = size - count;
+    if (rest > 0)
+    {
+        if (!probe.write((uint8_t *)data + count, in_buffer_addr, rest))
+            return -1;
+
+        in_head = rest - 1;
+    }
+
+    status[2] = in_head;
+    if (!probe.write(&status[2], getStatusAddress() + 2, 1))
+        return -1;
+
+    return size;
+}
+
+ChannelSet::ChannelSet()
+    : running(true),
+      idleSleep(1000),
+      reattach(false),
+      reconnecting(false),
+      failed(nullptr)
+{
+}
+
+void ChannelSet::add(Channel *channel)
+{
+    channels.push_back(channel);
+
+    // Keep channels on the same probe together so all their status words
+    // are read with one readv()
+    std::stable_sort(channels.begin(), channels.end(),
+                     [](Channel *a, Channel *b) {
+                         if (&a->getProbe() != &b->getProbe())
+                             return &a->getProbe() < &b->getProbe();
+                         return a->getStatusAddress() < b->getStatusAddress();
+                     });
+}
+
+int ChannelSet::poll()
+{
+    bool active = false;
+
+    size_t i = 0;
+    while (i < channels.size())
+    {
+        // All the channels on one probe together
+        Probe &probe = channels[i]->getProbe();
+        size_t j = i;
+        while (j < channels.size() && &channels[j]->getProbe() == &probe)
+            j++;
+
+        int res = probe.pollChannels(&channels[i], j - i);
+        if (res < 0)
+        {
+            failed = &probe;
+            return -1;
+        }
+
+        active |= (res > 0);
+        i = j;
+    }
+
+    return active;
+}
+
+bool ChannelSet::run(std::function<bool ()> hook)
+{
+    running = true;
+    while (running)
+    {
+        int res = poll();
+        if (res < 0)
+        {
+            if (!reattach || !reconnect(hook))
+                return false;
+
+            continue;
+        }
+
+        if (reattach)
+            findLost();
+
+        if (hook && !hook())
+            break;
+
+        // If we do not perform any input of output then sleep so we do
+        // not consume 100% CPU
+        if (res == 0 && idleSleep > 0)
+            usleep(idleSleep);
+    }
+
+    return true;
+}
+
+// Wait for the probe that failed to work again. Returns false if the probe
+// cannot be reopened or the hook gives up
+bool ChannelSet::reconnect(std::function<bool ()> &hook)
+{
+    // Transfers fail while the target is held in reset so first just try
+    // again for a while
+    for (int i = 0; i < REATTACH_RETRIES; i++)
+    {
+        usleep(1000);
+        if (poll() >= 0)
+            return true;
+    }
+
+    if (!failed->canReconnect())
+        return false;
+
+    fprintf(stderr, "Lost the probe, reconnecting\n");
+    reconnecting = true;
+    while (running)
+    {
+        if (failed->reconnect() && poll() >= 0)
+        {
+            fprintf(stderr, "Probe reconnected\n");
+            reconnecting = false;
+            return true;
+        }
+
+        if (hook && !hook())
+            break;
+
+        usleep(REATTACH_RECONNECT_MS * 1000);
+    }
+
+    reconnecting = false;
+    return false;
+}
+
+// Scan for channels that have been lost for a while in case the firmware
+// has changed and they have moved
+void ChannelSet::findLost()
+{
+    Clock::time_point now = Clock::now();
+    if (now < nextScan)
+        return;
+
+    Probe *scanned = nullptr;
+    std::vector<Channel::Location> found;
+    for (Channel *c : channels)
+    {
+        if (!c->isLost() || now - c->getLostTime() <
+            std::chrono::milliseconds(REATTACH_GRACE_MS))
+            continue;
+
+        nextScan = now + std::chrono::milliseconds(REATTACH_SCAN_MS);
+
+        if (&c->getProbe() != scanned)
+        {
+            scanned = &c->getProbe();
+            found = Channel::find(*scanned);
+        }
+
+        // Take the nearest block of the same type that no other channel
+        // is using
+        const Channel::Location *best = nullptr;
+        size_t best_distance = SIZE_MAX;
+        for (const Channel::Location &l : found)
+        {
+            if (l.magic != c->getMagic())
+                continue;
+
+            bool used = false;
+            for (Channel *o : channels)
+                if (o != c && &o->getProbe() == scanned &&
+                    o->getAddress() == l.address)
+                    used = true;
+            if (used)
+                continue;
+
+            size_t distance = l.address > c->getAddress() ?
+                l.address - c->getAddress() : c->getAddress() - l.address;
+            if (distance < best_distance)
+            {
+                best = &l;
+                best_distance = distance;
+            }
+        }
+
+        if (best != nullptr && best->address != c->getAddress())
+        {
+            fprintf(stderr, "Control block moved from 0x%zx to 0x%zx\n",
+                    c->getAddress(), best->address);
+            c->relocate(*best);
+        }
+    }
+}
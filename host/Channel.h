@@ -0,0 +1,178 @@
+#pragma once
+
+#include "Probe.h"
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <chrono>
+#include <functional>
+#include <string>
+#include <vector>
+
+// These change with the control block layout so blocks from firmware built
+// with an older library are not found. See src/SWDStream.h
+#define SWDPRINT_MAGIC  0xd5715e12
+#define SWDSTREAM_MAGIC 0xd5715e13
+
+// Time a channel can be lost before target RAM is scanned for it
+#define REATTACH_GRACE_MS 200
+
+// Host side of an SWDStream or SWDPrint control block in target RAM.
+// Output from the target is passed to the read callback. Input is taken
+// from data queued with write() and then from the write callback as space
+// becomes available in the target input buffer.
+//
+// Each poll reads the magic number and attach word along with the status so
+// a target reset is seen without an extra transfer. While the magic number
+// is missing the channel is lost and idle. The host sets the attach word and
+// only the firmware constructor clears it. When the magic number comes
+// back, or the attach word has been cleared, the firmware has started again
+// and the reset callback is called. Draining carries on from the new
+// indices.
+class Channel
+{
+public:
+    // Layout of the control block
+    static const size_t STATUS_OFFSET = 4;
+    static const size_t ATTACHED_OFFSET = 4 + 4;
+    // Magic number, status and attach word read by each poll
+    static const size_t HEADER_SIZE = 4 + 4 + 4;
+    static const size_t LOG_MASK_OFFSET = 4 + 4 + 4;
+    static const size_t OUT_BUFFER_OFFSET = 4 + 4 + 4 + 4;
+    static const size_t IN_BUFFER_OFFSET = 4 + 4 + 4 + 4 + 256;
+    static const size_t BUFFER_SIZE = 256;
+    // Value the host puts in the attach word
+    static const uint32_t ATTACHED = 0x4a77ac4e;
+
+    struct Location
+    {
+        size_t address;
+        uint32_t magic;
+    };
+
+    typedef std::function<void (const uint8_t *data, size_t size)>
+        ReadCallback;
+    // Return the number of bytes placed in buf
+    typedef std::function<size_t (uint8_t *buf, size_t max)> WriteCallback;
+    typedef std::function<void ()> ResetCallback;
+
+    Channel(Probe &probe, const Location &location);
+
+    // Search target RAM for control blocks
+    static std::vector<Location> find(Probe &probe);
+
+    Probe &getProbe() { return probe; }
+    size_t getAddress() const { return address; }
+    size_t getStatusAddress() const { return address + STATUS_OFFSET; }
+    bool hasInput() const { return magic == SWDSTREAM_MAGIC; }
+    uint32_t getMagic() const { return magic; }
+
+    // Mask of log levels and categories the firmware outputs. See
+    // src/SWDLog.h for the bits
+    bool getLogMask(uint32_t &mask);
+    bool setLogMask(uint32_t mask);
+
+    void setReadCallback(ReadCallback cb) { readCallback = cb; }
+    void setWriteCallback(WriteCallback cb) { writeCallback = cb; }
+    void setResetCallback(ResetCallback cb) { resetCallback = cb; }
+
+    // Queue data to be sent to the target
+    void write(const uint8_t *data, size_t size);
+    size_t pendingWrite() const { return pending.size(); }
+
+    // Take up to max bytes of input for the target, first the queued data
+    // and then from the write callback
+    size_t takeInput(uint8_t *buf, size_t max);
+
+    // Pass output that was read some other way to the read callback
+    void receive(const uint8_t *data, size_t size);
+
+    // Count a target restart that was seen some other way and call the
+    // reset callback
+    void reset();
+
+    // Transfer any data in both directions. Returns 1 if data was moved,
+    // 0 if idle or -1 on a probe error
+    int poll();
+
+    // Same as poll() using the first HEADER_SIZE bytes of the control block
+    // already read from the target
+    int poll(const uint8_t *header);
+
+    // True while the magic number is missing, such as while the target is
+    // held in reset or starting up
+    bool isLost() const { return lost; }
+    std::chrono::steady_clock::time_point getLostTime() const
+    {
+        return lostTime;
+    }
+
+    // Use a control block found by a scan after the firmware has changed
+    void relocate(const Location &location);
+
+    unsigned long getResets() const { return resets; }
+
+protected:
+    Probe &probe;
+    size_t address;
+    uint32_t magic;
+
+    ReadCallback readCallback;
+    WriteCallback writeCallback;
+    ResetCallback resetCallback;
+    std::string pending;
+
+    bool lost;
+    std::chrono::steady_clock::time_point lostTime;
+    // The attach word has been set in this control block
+    bool attached;
+    unsigned long resets;
+
+    int readOutput(uint8_t *status, uint8_t *buffer);
+    int writeInput(uint8_t *status, const uint8_t *data, int size);
+};
+
+// Services a group of channels. The channels on each probe are passed to
+// Probe::pollChannels() together so control blocks close together have
+// their status read in one transfer.
+class ChannelSet
+{
+public:
+    ChannelSet();
+
+    void add(Channel *channel);
+
+    // Service every channel once. Returns 1 if any channel was active, 0 if
+    // all were idle or -1 on a probe error
+    int poll();
+
+    // Poll until stop() is called, the hook returns false or there is an
+    // error. Sleeps for idleSleep microseconds when there is nothing to do.
+    // Returns false on error
+    bool run(std::function<bool ()> hook = nullptr);
+    void stop() { running = false; }
+
+    void setIdleSleep(unsigned int us) { idleSleep = us; }
+
+    // When set run() rides out target resets and probe unplugs. A probe
+    // error is retried for a short time in case the target is in reset and
+    // then the probe is reopened until it is back. A channel lost for more
+    // than REATTACH_GRACE_MS is looked for with a scan of target RAM in
+    // case the firmware has changed
+    void setReattach(bool b) { reattach = b; }
+    bool isReconnecting() const { return reconnecting; }
+
+protected:
+    std::vector<Channel *> channels;
+    volatile bool running;
+    unsigned int idleSleep;
+    bool reattach;
+    bool reconnecting;
+    // Probe of the last poll error
+    Probe *failed;
+    std::chrono::steady_clock::time_point nextScan;
+
+    bool reconnect(std::function<bool ()> &hook);
+    void findLost();
+};
@@ -0,0 +1,185 @@
+#include "ClockSync.h"
+
+#include <stdio.h>
+
+// Marker put before each timestamp by SWDStream
+#define TIMESTAMP_MARKER 0x1e
+
+ClockSync::ClockSync()
+    : counterAddress(DWT_CYCCNT),
+      window(32),
+      minRoundTrip(0),
+      started(false),
+      restarted(false),
+      lastRaw(0),
+      lastCount(0),
+      base(0),
+      intercept(0),
+      slope(0)
+{
+}
+
+bool ClockSync::sample(Probe &probe)
+{
+    uint8_t buf[4];
+    Clock::time_point before = Clock::now();
+    if (!probe.read(buf, counterAddress, sizeof(buf)))
+        return false;
+    Clock::time_point after = Clock::now();
+
+    uint32_t counter = buf[0] | (buf[1] << 8) | (buf[2] << 16) |
+        ((uint32_t)buf[3] << 24);
+
+    // The counter was read some time during the transfer so take the middle
+    addSample(counter, before + (after - before) / 2,
+              std::chrono::duration<double>(after - before).count());
+
+    return true;
+}
+
+void ClockSync::restart()
+{
+    samples.clear();
+    restarted = true;
+}
+
+int64_t ClockSync::unwrap(uint32_t counter) const
+{
+    return lastCount + (int32_t)(counter - lastRaw);
+}
+
+void ClockSync::addSample(uint32_t counter, Clock::time_point t,
+                          double roundTrip)
+{
+    if (!started)
+    {
+        started = true;
+        origin = t;
+        lastCount = counter;
+        lastRaw = counter;
+        minRoundTrip = roundTrip;
+    }
+
+    if (restarted)
+    {
+        restarted = false;
+        lastRaw = counter;
+    }
+
+    // Keep track of wrap around even for samples that are not used
+    lastCount = unwrap(counter);
+    lastRaw = counter;
+
+    // Skip samples delayed by the USB or host scheduling
+    if (roundTrip < minRoundTrip)
+        minRoundTrip = roundTrip;
+    else if (roundTrip > 2 * minRoundTrip + 100e-6)
+        return;
+
+    Sample s;
+    s.count = lastCount;
+    s.time = std::chrono::duration<double>(t - origin).count();
+    samples.push_back(s);
+    while (samples.size() > window)
+        samples.pop_front();
+
+    fit();
+}
+
+// Least squares fit of time against count
+void ClockSync::fit()
+{
+    if (samples.size() < 2)
+        return;
+
+    base = samples.front().count;
+
+    double n = samples.size();
+    double sx = 0, sy = 0;
+    for (const Sample &s : samples)
+    {
+        sx += s.count - base;
+        sy += s.time;
+    }
+
+    double mx = sx / n;
+    double my = sy / n;
+    double sxx = 0, sxy = 0;
+    for (const Sample &s : samples)
+    {
+        double dx = s.count - base - mx;
+        sxx += dx * dx;
+        sxy += dx * (s.time - my);
+    }
+
+    if (sxx <= 0)
+        return;
+
+    slope = sxy / sxx;
+    intercept = my - slope * mx;
+}
+
+ClockSync::Clock::time_point ClockSync::toHost(uint32_t counter) const
+{
+    double t = intercept + slope * (unwrap(counter) - base);
+    return origin + std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<double>(t));
+}
+
+TimestampDecoder::TimestampDecoder(ClockSync &clock_)
+    : clock(clock_),
+      lastTarget(0),
+      print(true),
+      stampPos(-1)
+{
+}
+
+void TimestampDecoder::decode(const uint8_t *data, size_t size,
+                              std::string &out)
+{
+    ClockSync::Clock::time_point now = ClockSync::Clock::now();
+
+    for (size_t i = 0; i < size; i++)
+    {
+        uint8_t c = data[i];
+
+        // A stamp may be split across polls
+        if (stampPos >= 0)
+        {
+            stamp[stampPos++] = c;
+            if (stampPos < 4)
+                continue;
+
+            stampPos = -1;
+            if (!clock.valid())
+            {
+                if (print)
+                    out += "           ? ";
+                continue;
+            }
+
+            uint32_t counter = stamp[0] | (stamp[1] << 8) |
+                (stamp[2] << 16) | ((uint32_t)stamp[3] << 24);
+            ClockSync::Clock::time_point t = clock.toHost(counter);
+            lastTarget = clock.unwrap(counter);
+
+            if (stampCallback)
+                stampCallback(t, out.size());
+
+            if (print)
+            {
+                char buf[32];
+                snprintf(buf, sizeof(buf), "%12.6f ",
+                         std::chrono::duration<double>(
+                             t - clock.getOrigin()).count());
+                out += buf;
+            }
+
+            latency.add(std::chrono::duration<double>(now - t).count());
+        }
+        else if (c == TIMESTAMP_MARKER)
+            stampPos = 0;
+        else
+            out += c;
+    }
+}
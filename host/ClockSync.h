@@ -0,0 +1,119 @@
+#pragma once
+
+#include "CommandClient.h"
+#include "Probe.h"
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <string>
+
+// DWT cycle counter on Cortex-M3 and above
+#define DWT_CYCCNT 0xE0001004
+
+// Maps a free running 32 bit counter on the target to host time. The
+// counter is read over the probe every so often and a straight line is
+// fitted to the recent samples so the mapping follows any drift between
+// the two clocks. Wrap around is handled as long as samples are taken more
+// often than every half period of the counter.
+class ClockSync
+{
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    ClockSync();
+
+    void setCounterAddress(size_t a) { counterAddress = a; }
+    // Number of samples in the fit
+    void setWindow(size_t n) { window = n > 2 ? n : 2; }
+
+    // Read the counter and add a sample. Returns false on a probe error
+    bool sample(Probe &probe);
+
+    // Add a counter value read at host time t. The round trip time of the
+    // read limits how well t is known
+    void addSample(uint32_t counter, Clock::time_point t, double roundTrip);
+
+    // Forget the samples after the counter has been reset, such as by a
+    // target reset. The unwrapped count carries on from where it was
+    void restart();
+
+    bool valid() const { return samples.size() >= 2; }
+
+    // Host time of a counter value close to the latest sample
+    Clock::time_point toHost(uint32_t counter) const;
+
+    // Counter value extended to 64 bits
+    int64_t unwrap(uint32_t counter) const;
+
+    // Host time of the first sample used as the origin for printed times
+    Clock::time_point getOrigin() const { return origin; }
+
+    // Counts per second
+    double getFrequency() const { return slope > 0 ? 1.0 / slope : 0; }
+
+protected:
+    struct Sample
+    {
+        int64_t count;
+        double time;
+    };
+
+    size_t counterAddress;
+    size_t window;
+    std::deque<Sample> samples;
+    double minRoundTrip;
+
+    bool started;
+    bool restarted;
+    Clock::time_point origin;
+    uint32_t lastRaw;
+    int64_t lastCount;
+
+    // time = intercept + slope * (count - base) in seconds since origin
+    int64_t base;
+    double intercept;
+    double slope;
+
+    void fit();
+};
+
+// Replaces the timestamps the firmware puts at the start of each line when
+// built with SWDSTREAM_TIMESTAMP by the host time in seconds. Also records
+// how long each line took to get from the firmware to the host.
+class TimestampDecoder
+{
+public:
+    // Called with the host time of each line and where the line starts in
+    // the decoded output
+    typedef std::function<void (ClockSync::Clock::time_point t, size_t pos)>
+        StampCallback;
+
+    TimestampDecoder(ClockSync &clock);
+
+    void setStampCallback(StampCallback cb) { stampCallback = cb; }
+
+    // If false the timestamps are removed without printing the time
+    void setPrint(bool b) { print = b; }
+
+    // Append the decoded text to out
+    void decode(const uint8_t *data, size_t size, std::string &out);
+
+    const LatencyHistogram &getLatency() const { return latency; }
+
+    // Unwrapped counter of the last timestamp or 0 if there has not been one
+    uint64_t getLastTarget() const { return lastTarget; }
+
+protected:
+    ClockSync &clock;
+    StampCallback stampCallback;
+    uint64_t lastTarget;
+    bool print;
+    uint8_t stamp[4];
+    // Bytes of the stamp still to come or -1 if not in a stamp
+    int stampPos;
+    LatencyHistogram latency;
+};
@@ -0,0 +1,267 @@
+#include "CommandClient.h"
+
+#include <stdio.h>
+
+#include <algorithm>
+
+// Buckets from 1us to 2^24us (about 16s)
+#define NUM_BUCKETS 25
+
+LatencyHistogram::LatencyHistogram()
+    : buckets(NUM_BUCKETS)
+{
+}
+
+void LatencyHistogram::add(double seconds)
+{
+    samples.push_back(seconds);
+
+    double us = seconds * 1e6;
+    size_t b = 0;
+    while (b < NUM_BUCKETS - 1 && us >= (double)(2 << b))
+        b++;
+
+    buckets[b]++;
+}
+
+void LatencyHistogram::clear()
+{
+    samples.clear();
+    std::fill(buckets.begin(), buckets.end(), 0);
+}
+
+void LatencyHistogram::print(FILE *fp) const
+{
+    if (samples.empty())
+    {
+        fprintf(fp, "No round trips\n");
+        return;
+    }
+
+    std::vector<double> sorted = samples;
+    std::sort(sorted.begin(), sorted.end());
+
+    double total = 0;
+    for (double s : sorted)
+        total += s;
+
+    auto percentile = [&sorted](double p) {
+        return sorted[std::min(sorted.size() - 1,
+                               (size_t)(p * sorted.size()))] * 1e3;
+    };
+
+    fprintf(fp, "%zu round trips min %.3fms mean %.3fms "
+            "p50 %.3fms p90 %.3fms p99 %.3fms max %.3fms\n",
+            sorted.size(), sorted.front() * 1e3,
+            total / sorted.size() * 1e3,
+            percentile(0.5), percentile(0.9), percentile(0.99),
+            sorted.back() * 1e3);
+
+    size_t max_count = *std::max_element(buckets.begin(), buckets.end());
+    for (size_t b = 0; b < NUM_BUCKETS; b++)
+    {
+        if (buckets[b] == 0)
+            continue;
+
+        int bar = (int)(50.0 * buckets[b] / max_count + 0.5);
+        fprintf(fp, "%9luus %8zu |%.*s\n",
+                (unsigned long)(1 << b), buckets[b], bar,
+                "**************************************************");
+    }
+}
+
+CommandClient::CommandClient()
+    : address(-1),
+      useCRC(false),
+      window(1),
+      batchSent(false),
+      outputQueued(0),
+      outputWritten(0),
+      errors(0),
+      crcErrors(0)
+{
+}
+
+uint16_t CommandClient::crc16(const char *data, size_t size, uint16_t crc)
+{
+    // Same as _crc_ccitt_update() in the firmware
+    for (size_t i = 0; i < size; i++)
+    {
+        uint8_t d = data[i];
+        d ^= crc & 0xff;
+        d ^= d << 4;
+        crc = ((((uint16_t)d << 8) | (crc >> 8)) ^ (uint8_t)(d >> 4)
+               ^ ((uint16_t)d << 3));
+    }
+
+    return crc;
+}
+
+void CommandClient::queue(const std::string &command)
+{
+    queued.push_back(command);
+}
+
+void CommandClient::fillOutput()
+{
+    if (!batchSent)
+    {
+        // Ctrl-B puts the parser in batch mode so there is no echo or prompt
+        output += '\x02';
+        outputQueued++;
+        batchSent = true;
+    }
+
+    while (!queued.empty() && sent.size() < window)
+    {
+        std::string cmd = queued.front();
+        queued.pop_front();
+
+        std::string packet;
+        if (address >= 0)
+        {
+            char buf[8];
+            snprintf(buf, sizeof(buf), "@%X ", address);
+            packet += buf;
+        }
+
+        packet += cmd;
+
+        if (useCRC)
+        {
+            // The CRC covers everything after the address up to the '$'
+            std::string body = cmd + " ";
+            char buf[8];
+            snprintf(buf, sizeof(buf), "$%04X",
+                     crc16(body.data(), body.size()));
+            packet += " ";
+            packet += buf;
+        }
+
+        packet += '\n';
+        output += packet;
+        outputQueued += packet.size();
+
+        Pending p;
+        p.outputEnd = outputQueued;
+        p.written = false;
+        p.result.command = cmd;
+        p.result.ok = false;
+        p.result.crcError = false;
+        p.result.latency = 0;
+        sent.push_back(p);
+    }
+}
+
+size_t CommandClient::getOutput(uint8_t *buf, size_t max)
+{
+    fillOutput();
+
+    size_t n = std::min(max, output.size());
+    std::copy(output.begin(), output.begin() + n, buf);
+    output.erase(0, n);
+    outputWritten += n;
+
+    // Round trips are timed from when the whole command has been written
+    Clock::time_point now = Clock::now();
+    for (Pending &p : sent)
+    {
+        if (!p.written && p.outputEnd <= outputWritten)
+        {
+            p.written = true;
+            p.sentTime = now;
+        }
+    }
+
+    return n;
+}
+
+void CommandClient::receive(const uint8_t *data, size_t size)
+{
+    for (size_t i = 0; i < size; i++)
+    {
+        char c = data[i];
+        if (c == '\n')
+        {
+            processLine(line);
+            line.clear();
+        }
+        else if (c != '\r')
+            line += c;
+    }
+}
+
+void CommandClient::targetReset()
+{
+    batchSent = false;
+    // Part of a line from before the reset is not a response
+    line.clear();
+}
+
+void CommandClient::processLine(std::string l)
+{
+    // Anything output before the first command is sent is not a response
+    if (sent.empty() || l.empty())
+        return;
+
+    Pending &p = sent.front();
+
+    // Strip the response prefix from an addressed device
+    if (address >= 0 && l[0] == '*')
+    {
+        size_t space = l.find(' ');
+        if (space != std::string::npos)
+            l.erase(0, space + 1);
+    }
+
+    if (useCRC)
+    {
+        size_t dollar = l.rfind('$');
+        if (dollar == std::string::npos)
+            p.result.crcError = true;
+        else
+        {
+            unsigned int expected = 0;
+            if (sscanf(l.c_str() + dollar + 1, "%X", &expected) != 1 ||
+                expected != crc16(l.data(), dollar))
+                p.result.crcError = true;
+
+            l.erase(dollar);
+        }
+    }
+
+    if (l == "OK" || l == "ERROR")
+    {
+        p.result.ok = (l == "OK");
+        p.result.latency =
+            std::chrono::duration<double>(Clock::now() - p.sentTime).count();
+
+        latency.add(p.result.latency);
+        if (!p.result.ok)
+            errors++;
+        if (p.result.crcError)
+            crcErrors++;
+
+        Result r = p.result;
+        sent.pop_front();
+
+        if (resultCallback)
+            resultCallback(r);
+    }
+    else
+        p.result.lines.push_back(l);
+}
+
+bool CommandClient::done() const
+{
+    return queued.empty() && sent.empty() && output.empty();
+}
+
+double CommandClient::oldestAge() const
+{
+    if (sent.empty() || !sent.front().written)
+        return 0;
+
+    return std::chrono::duration<double>(Clock::now() -
+                                         sent.front().sentTime).count();
+}
@@ -0,0 +1,123 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <string>
+#include <vector>
+
+// Round trip times bucketed by powers of two microseconds
+class LatencyHistogram
+{
+public:
+    LatencyHistogram();
+
+    void add(double seconds);
+    void clear();
+    size_t count() const { return samples.size(); }
+
+    void print(FILE *fp) const;
+
+protected:
+    std::vector<double> samples;
+    std::vector<size_t> buckets;
+};
+
+// Host side of the CommandParser protocol. Commands are queued and sent
+// with the optional RS485 address and CRC16 checksum. Up to a window of
+// commands are in flight at once and responses are matched to commands in
+// order by their OK or ERROR status line.
+//
+// The client does not do any I/O itself. The caller moves bytes from
+// getOutput() to the target and passes anything received to receive().
+class CommandClient
+{
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    struct Result
+    {
+        std::string command;
+        std::vector<std::string> lines;
+        bool ok;
+        // Set if a response line had a missing or incorrect CRC
+        bool crcError;
+        double latency;
+    };
+
+    typedef std::function<void (const Result &)> ResultCallback;
+
+    CommandClient();
+
+    // RS485 address of the target or -1 for none
+    void setAddress(int addr) { address = addr; }
+    void setCRC(bool b) { useCRC = b; }
+    // Maximum number of commands sent without a response
+    void setWindow(size_t n) { window = n > 0 ? n : 1; }
+    void setResultCallback(ResultCallback cb) { resultCallback = cb; }
+
+    void queue(const std::string &command);
+
+    // Move up to max bytes of command output to buf
+    size_t getOutput(uint8_t *buf, size_t max);
+
+    // Process bytes received from the target
+    void receive(const uint8_t *data, size_t size);
+
+    // Call when the target restarts. Its parser is back in normal mode so
+    // Ctrl-B is sent again before the next command
+    void targetReset();
+
+    // True when every queued command has a response
+    bool done() const;
+
+    size_t inFlight() const { return sent.size(); }
+
+    // Age in seconds of the oldest command without a response
+    double oldestAge() const;
+
+    const LatencyHistogram &getLatency() const { return latency; }
+    size_t getErrors() const { return errors; }
+    size_t getCRCErrors() const { return crcErrors; }
+
+    // CRC16 as used by CommandParser
+    static uint16_t crc16(const char *data, size_t size,
+                          uint16_t crc = 0xffff);
+
+protected:
+    struct Pending
+    {
+        // Position in the output stream after the last byte of the command
+        uint64_t outputEnd;
+        bool written;
+        Clock::time_point sentTime;
+        Result result;
+    };
+
+    int address;
+    bool useCRC;
+    size_t window;
+    bool batchSent;
+
+    // Commands not yet sent to the target
+    std::deque<std::string> queued;
+    // Commands sent and waiting for a response
+    std::deque<Pending> sent;
+    // Encoded bytes waiting to be written to the target
+    std::string output;
+    uint64_t outputQueued;
+    uint64_t outputWritten;
+    // Partial response line
+    std::string line;
+
+    ResultCallback resultCallback;
+    LatencyHistogram latency;
+    size_t errors;
+    size_t crcErrors;
+
+    void fillOutput();
+    void processLine(std::string l);
+};
@@ -0,0 +1,165 @@
+#include "CoreDump.h"
+
+#include <elf.h>
+#include <stdio.h>
+#include <string.h>
+
+// Layout of struct elf_prstatus for 32 bit ARM Linux which is what gdb
+// expects in a core file
+#define PRSTATUS_SIZE 148
+#define PRSTATUS_CURSIG 12
+#define PRSTATUS_PID 24
+#define PRSTATUS_REG 72
+// r0-r15, cpsr and orig_r0
+#define PRSTATUS_NUM_REGS 18
+
+// pr_reg is followed by the 4 byte pr_fpvalid
+static_assert(PRSTATUS_REG + PRSTATUS_NUM_REGS * 4 + 4 == PRSTATUS_SIZE,
+              "elf_prstatus layout");
+static_assert(CORE_DUMP_REGISTERS <= PRSTATUS_NUM_REGS,
+              "More registers than pr_reg holds");
+
+#define NOTE_NAME "CORE"
+
+CoreDump::CoreDump()
+    : haveRegisters(false)
+{
+    memset(registers, 0, sizeof(registers));
+}
+
+void CoreDump::addRegion(size_t address, size_t size)
+{
+    Region r;
+    r.address = address;
+    r.data.resize(size);
+    regions.push_back(r);
+}
+
+void CoreDump::setRegisters(const uint32_t *regs)
+{
+    memcpy(registers, regs, sizeof(registers));
+    haveRegisters = true;
+}
+
+size_t CoreDump::getSize() const
+{
+    size_t size = 0;
+    for (const Region &r : regions)
+        size += r.data.size();
+
+    return size;
+}
+
+bool CoreDump::read(Probe &probe)
+{
+    // The probe splits each region into the largest transfers it can do
+    for (Region &r : regions)
+    {
+        if (!probe.read(r.data.data(), r.address, r.data.size()))
+        {
+            fprintf(stderr, "Failed to read 0x%zx bytes at 0x%zx\n",
+                    r.data.size(), r.address);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static void putWord(uint8_t *p, uint32_t v)
+{
+    memcpy(p, &v, sizeof(v));
+}
+
+bool CoreDump::write(const std::string &filename) const
+{
+    size_t num_phdrs = regions.size() + 1;
+
+    // The note with the registers
+    Elf32_Nhdr nhdr;
+    nhdr.n_namesz = sizeof(NOTE_NAME);
+    nhdr.n_descsz = PRSTATUS_SIZE;
+    nhdr.n_type = NT_PRSTATUS;
+
+    uint8_t name[8] = {};
+    memcpy(name, NOTE_NAME, sizeof(NOTE_NAME));
+
+    uint8_t prstatus[PRSTATUS_SIZE] = {};
+    // Report it as stopped by SIGTRAP like a breakpoint
+    prstatus[PRSTATUS_CURSIG] = 5;
+    putWord(prstatus + PRSTATUS_PID, 1);
+    for (int i = 0; i < CORE_DUMP_REGISTERS; i++)
+        putWord(prstatus + PRSTATUS_REG + i * 4, registers[i]);
+
+    size_t note_size = sizeof(nhdr) + sizeof(name) + sizeof(prstatus);
+
+    Elf32_Ehdr ehdr = {};
+    memcpy(ehdr.e_ident, ELFMAG, SELFMAG);
+    ehdr.e_ident[EI_CLASS] = ELFCLASS32;
+    ehdr.e_ident[EI_DATA] = ELFDATA2LSB;
+    ehdr.e_ident[EI_VERSION] = EV_CURRENT;
+    ehdr.e_ident[EI_OSABI] = ELFOSABI_NONE;
+    ehdr.e_type = ET_CORE;
+    ehdr.e_machine = EM_ARM;
+    ehdr.e_version = EV_CURRENT;
+    ehdr.e_phoff = sizeof(ehdr);
+    ehdr.e_flags = EF_ARM_EABI_VER5;
+    ehdr.e_ehsize = sizeof(ehdr);
+    ehdr.e_phentsize = sizeof(Elf32_Phdr);
+    ehdr.e_phnum = num_phdrs;
+
+    std::vector<Elf32_Phdr> phdrs(num_phdrs);
+    size_t offset = sizeof(ehdr) + num_phdrs * sizeof(Elf32_Phdr);
+
+    Elf32_Phdr &note = phdrs[0];
+    memset(&note, 0, sizeof(note));
+    note.p_type = PT_NOTE;
+    note.p_offset = offset;
+    note.p_filesz = haveRegisters ? note_size : 0;
+    note.p_align = 4;
+    offset += note.p_filesz;
+
+    for (size_t i = 0; i < regions.size(); i++)
+    {
+        Elf32_Phdr &p = phdrs[i + 1];
+        memset(&p, 0, sizeof(p));
+        p.p_type = PT_LOAD;
+        p.p_offset = offset;
+        p.p_vaddr = regions[i].address;
+        p.p_paddr = regions[i].address;
+        p.p_filesz = regions[i].data.size();
+        p.p_memsz = regions[i].data.size();
+        p.p_flags = PF_R | PF_W;
+        p.p_align = 4;
+        offset += p.p_filesz;
+    }
+
+    FILE *fp = fopen(filename.c_str(), "wb");
+    if (fp == nullptr)
+    {
+        perror(filename.c_str());
+        return false;
+    }
+
+    bool ok = fwrite(&ehdr, sizeof(ehdr), 1, fp) == 1 &&
+        fwrite(phdrs.data(), sizeof(Elf32_Phdr), num_phdrs, fp) == num_phdrs;
+
+    if (ok && haveRegisters)
+        ok = fwrite(&nhdr, sizeof(nhdr), 1, fp) == 1 &&
+            fwrite(name, sizeof(name), 1, fp) == 1 &&
+            fwrite(prstatus, sizeof(prstatus), 1, fp) == 1;
+
+    for (const Region &r : regions)
+    {
+        if (ok && !r.data.empty())
+            ok = fwrite(r.data.data(), r.data.size(), 1, fp) == 1;
+    }
+
+    if (fclose(fp) != 0)
+        ok = false;
+
+    if (!ok)
+        perror(filename.c_str());
+
+    return ok;
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include "Probe.h"
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <string>
+#include <vector>
+
+// Number of registers saved, r0 to r15 then xPSR
+#define CORE_DUMP_REGISTERS 17
+
+// Snapshot of target memory and core registers written as an ELF core
+// file. Load it with the firmware ELF using "gdb firmware.elf core". Each
+// memory region is a PT_LOAD segment and the registers are in an ARM
+// NT_PRSTATUS note.
+class CoreDump
+{
+public:
+    CoreDump();
+
+    void addRegion(size_t address, size_t size);
+
+    void setRegisters(const uint32_t *regs);
+
+    // Read every region from the probe
+    bool read(Probe &probe);
+
+    bool write(const std::string &filename) const;
+
+    size_t getSize() const;
+
+protected:
+    struct Region
+    {
+        size_t address;
+        std::vector<uint8_t> data;
+    };
+
+    std::vector<Region> regions;
+    bool haveRegisters;
+    uint32_t registers[CORE_DUMP_REGISTERS];
+};
@@ -0,0 +1,214 @@
+#include "LineFilter.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define HIGHLIGHT_START "\033[1;31m"
+#define HIGHLIGHT_END "\033[0m"
+
+LineFilter::LineFilter()
+    : highlight(false),
+      lines(0),
+      passed(0)
+{
+}
+
+LineFilter::~LineFilter()
+{
+    for (std::vector<Pattern *> *list : { &includes, &excludes })
+    {
+        for (Pattern *p : *list)
+        {
+            if (p->isRegex)
+                regfree(&p->regex);
+            delete p;
+        }
+    }
+}
+
+bool LineFilter::addInclude(const std::string &pattern, bool regex)
+{
+    return add(includes, pattern, regex);
+}
+
+bool LineFilter::addExclude(const std::string &pattern, bool regex)
+{
+    return add(excludes, pattern, regex);
+}
+
+bool LineFilter::add(std::vector<Pattern *> &list, const std::string &pattern,
+                     bool regex)
+{
+    Pattern *p = new Pattern;
+    p->text = pattern;
+    p->isRegex = regex;
+
+    if (regex)
+    {
+        int res = regcomp(&p->regex, pattern.c_str(), REG_EXTENDED);
+        if (res != 0)
+        {
+            char msg[128];
+            regerror(res, &p->regex, msg, sizeof(msg));
+            fprintf(stderr, "Bad regular expression '%s': %s\n",
+                    pattern.c_str(), msg);
+            delete p;
+            return false;
+        }
+    }
+
+    list.push_back(p);
+    return true;
+}
+
+void LineFilter::process(const char *data, size_t size, std::string &out)
+{
+    const char *end = data + size;
+
+    // Complete a line left over from the last call
+    if (!partial.empty())
+    {
+        const char *nl = (const char *)memchr(data, '\n', size);
+        if (nl == nullptr)
+        {
+            partial.append(data, size);
+            return;
+        }
+
+        partial.append(data, nl - data);
+        processLine(partial.data(), partial.size(), out);
+        partial.clear();
+        data = nl + 1;
+    }
+
+    // Work on lines in place while they are in the buffer
+    while (data < end)
+    {
+        const char *nl = (const char *)memchr(data, '\n', end - data);
+        if (nl == nullptr)
+        {
+            partial.assign(data, end - data);
+            break;
+        }
+
+        processLine(data, nl - data, out);
+        data = nl + 1;
+    }
+}
+
+void LineFilter::flush(std::string &out)
+{
+    if (partial.empty())
+        return;
+
+    size_t start = out.size();
+    processLine(partial.data(), partial.size(), out);
+    partial.clear();
+
+    // processLine() added a newline that was not there unless the line was
+    // filtered out
+    if (out.size() > start && out.back() == '\n')
+        out.pop_back();
+}
+
+bool LineFilter::find(Pattern *p, const char *line, size_t size, size_t start,
+                      size_t &match_start, size_t &match_end)
+{
+    if (!p->isRegex)
+    {
+        if (p->text.empty())
+            return false;
+
+        const char *m = (const char *)memmem(line + start, size - start,
+                                             p->text.data(), p->text.size());
+        if (m == nullptr)
+            return false;
+
+        match_start = m - line;
+        match_end = match_start + p->text.size();
+        return true;
+    }
+
+    // regexec() wants a terminated string
+    if (scratch.empty())
+        scratch.assign(line, size);
+
+    regmatch_t m;
+    int flags = start > 0 ? REG_NOTBOL : 0;
+    if (regexec(&p->regex, scratch.c_str() + start, 1, &m, flags) != 0)
+        return false;
+
+    match_start = start + m.rm_so;
+    match_end = start + m.rm_eo;
+    return true;
+}
+
+void LineFilter::processLine(const char *line, size_t size, std::string &out)
+{
+    lines++;
+
+    // Let any regex copy the line once for all the patterns
+    scratch.clear();
+
+    // Keep the \r of a \r\n line out of the matching and highlighting
+    size_t text_size = size;
+    if (text_size > 0 && line[text_size - 1] == '\r')
+        text_size--;
+
+    size_t ms, me;
+    for (Pattern *p : excludes)
+    {
+        if (find(p, line, text_size, 0, ms, me))
+            return;
+    }
+
+    bool match = includes.empty();
+    for (Pattern *p : includes)
+    {
+        if (find(p, line, text_size, 0, ms, me))
+        {
+            match = true;
+            break;
+        }
+    }
+
+    if (!match)
+        return;
+
+    passed++;
+
+    if (!highlight || includes.empty())
+    {
+        out.append(line, size);
+        out += '\n';
+        return;
+    }
+
+    // Mark the earliest match of any include pattern then carry on after it
+    size_t pos = 0;
+    while (pos < text_size)
+    {
+        size_t best_start = text_size, best_end = text_size;
+        for (Pattern *p : includes)
+        {
+            if (find(p, line, text_size, pos, ms, me) && ms < best_start &&
+                me > ms)
+            {
+                best_start = ms;
+                best_end = me;
+            }
+        }
+
+        if (best_start == text_size)
+            break;
+
+        out.append(line + pos, best_start - pos);
+        out += HIGHLIGHT_START;
+        out.append(line + best_start, best_end - best_start);
+        out += HIGHLIGHT_END;
+        pos = best_end;
+    }
+
+    out.append(line + pos, size - pos);
+    out += '\n';
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <regex.h>
+
+#include <string>
+#include <vector>
+
+// Passes through lines of output that match any of the include patterns
+// and none of the exclude patterns, optionally highlighting the matches.
+// Patterns are plain substrings or POSIX extended regular expressions.
+// Data can arrive in any size pieces and a line split between polls is
+// held until it is complete. Each channel needs its own filter.
+//
+// Lines are found with memchr() and substrings with memmem() which glibc
+// implements with SSE2/AVX2 so most of the data is only scanned by vector
+// code. Only lines that need a regular expression are copied.
+class LineFilter
+{
+public:
+    LineFilter();
+    ~LineFilter();
+
+    // Returns false if a regular expression does not compile
+    bool addInclude(const std::string &pattern, bool regex = false);
+    bool addExclude(const std::string &pattern, bool regex = false);
+
+    void setHighlight(bool b) { highlight = b; }
+
+    // True if there is nothing to filter so data can bypass the filter
+    bool empty() const { return includes.empty() && excludes.empty(); }
+
+    // Append the lines that pass to out
+    void process(const char *data, size_t size, std::string &out);
+
+    // Filter any partial line left over
+    void flush(std::string &out);
+
+    size_t getLines() const { return lines; }
+    size_t getPassed() const { return passed; }
+
+protected:
+    struct Pattern
+    {
+        std::string text;
+        bool isRegex;
+        regex_t regex;
+    };
+
+    std::vector<Pattern *> includes;
+    std::vector<Pattern *> excludes;
+    bool highlight;
+
+    std::string partial;
+    std::string scratch;
+
+    size_t lines;
+    size_t passed;
+
+    bool add(std::vector<Pattern *> &list, const std::string &pattern,
+             bool regex);
+
+    // Find the first match in line at or after start
+    bool find(Pattern *p, const char *line, size_t size, size_t start,
+              size_t &match_start, size_t &match_end);
+
+    void processLine(const char *line, size_t size, std::string &out);
+};
@@ -0,0 +1,148 @@
+#include "LogMerger.h"
+
+#include <stdio.h>
+#include <string.h>
+
+LogMerger::LogMerger(Output output_)
+    : output(output_),
+      window(std::chrono::milliseconds(50)),
+      sequence(0),
+      tagWidth(0),
+      started(false),
+      lines(0),
+      late(0)
+{
+}
+
+void LogMerger::setWindow(double seconds)
+{
+    window = std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<double>(seconds));
+}
+
+size_t LogMerger::addSource(const std::string &tag)
+{
+    Source s;
+    s.tag = tag;
+    s.inLine = false;
+    sources.push_back(s);
+
+    if (tag.size() > tagWidth)
+        tagWidth = tag.size();
+
+    return sources.size() - 1;
+}
+
+void LogMerger::receive(size_t source, const char *data, size_t size,
+                        Clock::time_point t)
+{
+    Source &s = sources[source];
+
+    while (size > 0)
+    {
+        if (!s.inLine)
+        {
+            s.inLine = true;
+            s.partialTime = t;
+        }
+
+        const char *nl = (const char *)memchr(data, '\n', size);
+        if (nl == nullptr)
+        {
+            s.partial.append(data, size);
+            return;
+        }
+
+        s.partial.append(data, nl - data);
+        addLine(source, s.partialTime, s.partial);
+        s.partial.clear();
+        s.inLine = false;
+
+        size -= nl + 1 - data;
+        data = nl + 1;
+    }
+}
+
+void LogMerger::addLine(size_t source, Clock::time_point t, std::string &text)
+{
+    Source &s = sources[source];
+
+    if (!text.empty() && text.back() == '\r')
+        text.pop_back();
+
+    // Keep each source in the order it was written even if the times jitter
+    if (!s.lines.empty() && t < s.lines.back().time)
+        t = s.lines.back().time;
+
+    // Too late to go in order so output next
+    if (started && t < last)
+    {
+        t = last;
+        late++;
+    }
+
+    s.lines.push_back(Line());
+    s.lines.back().time = t;
+    s.lines.back().text.swap(text);
+
+    if (s.lines.size() == 1)
+        heap.push(Head { t, sequence++, source });
+}
+
+void LogMerger::emit(size_t source)
+{
+    Source &s = sources[source];
+    Line &l = s.lines.front();
+
+    if (!started)
+    {
+        started = true;
+        origin = l.time;
+    }
+    last = l.time;
+
+    char prefix[32];
+    snprintf(prefix, sizeof(prefix), "%12.6f ",
+             std::chrono::duration<double>(l.time - origin).count());
+    buffer += prefix;
+    buffer += s.tag;
+    buffer.append(tagWidth - s.tag.size() + 1, ' ');
+    buffer += l.text;
+    buffer += '\n';
+    lines++;
+
+    s.lines.pop_front();
+    if (!s.lines.empty())
+        heap.push(Head { s.lines.front().time, sequence++, source });
+}
+
+void LogMerger::flush(Clock::time_point now)
+{
+    while (!heap.empty() && heap.top().time + window <= now)
+    {
+        size_t source = heap.top().source;
+        heap.pop();
+        emit(source);
+    }
+
+    if (!buffer.empty())
+    {
+        output(buffer.data(), buffer.size());
+        buffer.clear();
+    }
+}
+
+void LogMerger::flushAll()
+{
+    for (size_t i = 0; i < sources.size(); i++)
+    {
+        if (sources[i].inLine)
+        {
+            sources[i].inLine = false;
+            addLine(i, sources[i].partialTime, sources[i].partial);
+            sources[i].partial.clear();
+        }
+    }
+
+    flush(Clock::time_point::max() - window);
+}
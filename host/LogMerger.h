@@ -0,0 +1,98 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <queue>
+#include <string>
+#include <vector>
+
+// Interleaves the output of several sources into one stream in time
+// order. Each source buffers its complete lines with the time each one
+// started. A heap holding the oldest line of each source picks the next
+// line to output once it is older than the reordering window, so lines
+// that reach the host up to a window late still come out in order. Lines
+// later than that are output straight away and counted.
+//
+// Each output line is the time in seconds since the first line, the
+// source tag and the text.
+class LogMerger
+{
+public:
+    typedef std::chrono::steady_clock Clock;
+    typedef std::function<void (const char *data, size_t size)> Output;
+
+    LogMerger(Output output);
+
+    void setWindow(double seconds);
+
+    // Returns the index used to pass output from the source
+    size_t addSource(const std::string &tag);
+
+    // Output from a source. Lines that start in data are given time t
+    void receive(size_t source, const char *data, size_t size,
+                 Clock::time_point t);
+
+    // Output the lines older than the window in time order
+    void flush(Clock::time_point now);
+
+    // Output everything including partial lines
+    void flushAll();
+
+    unsigned long getLines() const { return lines; }
+    unsigned long getLate() const { return late; }
+
+protected:
+    struct Line
+    {
+        Clock::time_point time;
+        std::string text;
+    };
+
+    struct Source
+    {
+        std::string tag;
+        std::deque<Line> lines;
+        // Line still being received
+        std::string partial;
+        Clock::time_point partialTime;
+        bool inLine;
+    };
+
+    struct Head
+    {
+        Clock::time_point time;
+        // Tie break so equal times keep the order they arrived in
+        unsigned long sequence;
+        size_t source;
+
+        bool operator>(const Head &h) const
+        {
+            if (time != h.time)
+                return time > h.time;
+            return sequence > h.sequence;
+        }
+    };
+
+    Output output;
+    Clock::duration window;
+    std::vector<Source> sources;
+    std::priority_queue<Head, std::vector<Head>, std::greater<Head>> heap;
+    unsigned long sequence;
+    size_t tagWidth;
+
+    bool started;
+    Clock::time_point origin;
+    // Time of the last line output
+    Clock::time_point last;
+    std::string buffer;
+
+    unsigned long lines;
+    unsigned long late;
+
+    void addLine(size_t source, Clock::time_point t, std::string &text);
+    void emit(size_t source);
+};
@@ -0,0 +1,144 @@
+#include "PCSampler.h"
+#include "STLink.h"
+
+#include <algorithm>
+#include <map>
+#include <vector>
+
+// Reads of zero in a row at the start that mean there is no PCSR
+#define PCSR_PROBE_READS 16
+
+PCSampler::PCSampler(Probe &probe_, STLink *stlink_)
+    : probe(probe_),
+      stlink(stlink_),
+      halting(false),
+      zeroReads(0),
+      samples(0),
+      idle(0)
+{
+}
+
+bool PCSampler::sample(unsigned int count)
+{
+    for (unsigned int i = 0; i < count; i++)
+        if (!sampleOne())
+            return false;
+
+    return true;
+}
+
+bool PCSampler::sampleOne()
+{
+    uint32_t pc, lr = 0;
+
+    if (halting)
+    {
+        uint32_t regs[17];
+        if (!stlink->halt())
+            return false;
+        bool ok = stlink->readRegisters(regs);
+        if (!stlink->resume() || !ok)
+            return false;
+
+        pc = regs[15];
+        lr = regs[14] & ~1u;
+    }
+    else
+    {
+        uint8_t buf[4];
+        if (!probe.read(buf, DWT_PCSR, sizeof(buf)))
+            return false;
+
+        pc = buf[0] | (buf[1] << 8) | (buf[2] << 16) |
+            ((uint32_t)buf[3] << 24);
+
+        // Not implemented reads as zero
+        if (samples == 0 && pc == 0)
+        {
+            if (++zeroReads >= PCSR_PROBE_READS && stlink != nullptr)
+            {
+                fprintf(stderr, "No DWT_PCSR, sampling by halting the "
+                        "core\n");
+                halting = true;
+            }
+            return true;
+        }
+
+        // All ones while the core is sleeping or halted
+        if (pc == 0xffffffff)
+        {
+            idle++;
+            samples++;
+            return true;
+        }
+    }
+
+    counts[((uint64_t)lr << 32) | pc]++;
+    samples++;
+
+    return true;
+}
+
+void PCSampler::printFlat(FILE *fp, const SymbolTable &symbols,
+                          size_t max_rows) const
+{
+    std::map<std::string, unsigned long> functions;
+    for (const auto &c : counts)
+        functions[symbols.name((uint32_t)c.first)] += c.second;
+    if (idle > 0)
+        functions["[idle]"] += idle;
+
+    std::vector<std::pair<std::string, unsigned long>> sorted(
+        functions.begin(), functions.end());
+    std::sort(sorted.begin(), sorted.end(),
+              [](const std::pair<std::string, unsigned long> &a,
+                 const std::pair<std::string, unsigned long> &b) {
+                  return a.second > b.second;
+              });
+
+    fprintf(fp, "%lu samples%s\n", samples,
+            halting ? " by halting" : "");
+    fprintf(fp, "%7s %10s  %s\n", "%", "samples", "function");
+    for (size_t i = 0; i < sorted.size() && i < max_rows; i++)
+        fprintf(fp, "%6.2f%% %10lu  %s\n",
+                samples > 0 ? 100.0 * sorted[i].second / samples : 0.0,
+                sorted[i].second, sorted[i].first.c_str());
+}
+
+bool PCSampler::writeFolded(const std::string &filename,
+                            const SymbolTable &symbols) const
+{
+    std::map<std::string, unsigned long> stacks;
+    for (const auto &c : counts)
+    {
+        uint32_t pc = c.first;
+        uint32_t lr = c.first >> 32;
+
+        std::string stack = symbols.name(pc);
+        // An lr in the same function is a return address from an earlier
+        // call rather than the caller. EXC_RETURN values are skipped
+        if (lr != 0 && lr < 0xf0000000)
+        {
+            std::string caller = symbols.name(lr);
+            if (caller != stack)
+                stack = caller + ";" + stack;
+        }
+
+        stacks[stack] += c.second;
+    }
+    if (idle > 0)
+        stacks["[idle]"] += idle;
+
+    FILE *fp = fopen(filename.c_str(), "w");
+    if (fp == nullptr)
+    {
+        perror(filename.c_str());
+        return false;
+    }
+
+    for (const auto &s : stacks)
+        fprintf(fp, "%s %lu\n", s.first.c_str(), s.second);
+
+    fclose(fp);
+    return true;
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include "Probe.h"
+#include "SymbolTable.h"
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <string>
+#include <unordered_map>
+
+class STLink;
+
+// DWT program counter sample register
+#define DWT_PCSR 0xE000101C
+
+// Statistical profile from the program counter of the running target.
+// Each sample is a read of DWT_PCSR which does not disturb the core. Cores
+// without it, such as the Cortex-M0, read it as zero so if given an STLink
+// the sampler falls back to briefly halting the core and reading the pc
+// and lr registers.
+class PCSampler
+{
+public:
+    PCSampler(Probe &probe, STLink *stlink = nullptr);
+
+    // Take count samples. Returns false on a probe error
+    bool sample(unsigned int count = 1);
+
+    bool usesHalt() const { return halting; }
+    unsigned long getSamples() const { return samples; }
+
+    // Samples per function, most first
+    void printFlat(FILE *fp, const SymbolTable &symbols,
+                   size_t max_rows = 30) const;
+
+    // One "caller;function count" line per call site for flame graph
+    // tools. The caller is only known when halting
+    bool writeFolded(const std::string &filename,
+                     const SymbolTable &symbols) const;
+
+protected:
+    Probe &probe;
+    STLink *stlink;
+    bool halting;
+    // Zero reads before deciding PCSR is not there
+    unsigned int zeroReads;
+
+    unsigned long samples;
+    // Core sleeping or halted by something else
+    unsigned long idle;
+    // Count for each pc in the low word and lr in the high word
+    std::unordered_map<uint64_t, unsigned long> counts;
+
+    bool sampleOne();
+};
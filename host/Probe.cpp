@@ -0,0 +1,124 @@
+#include "Probe.h"
+#include "Channel.h"
+
+#include <string.h>
+
+#include <algorithm>
+
+Probe::Probe()
+    : readvRegions(0),
+      readvTransfers(0)
+{
+}
+
+void Probe::planReads(const ProbeRegion *regions, size_t count,
+                      double fixedCost, double byteCost, ReadPlan &plan)
+{
+    plan.order.resize(count);
+    plan.transfers.clear();
+
+    for (size_t i = 0; i < count; i++)
+        plan.order[i] = i;
+
+    std::sort(plan.order.begin(), plan.order.end(),
+              [regions](size_t a, size_t b) {
+                  return regions[a].address < regions[b].address;
+              });
+
+    // Largest gap worth reading to save a transfer
+    size_t max_gap = byteCost > 0 ? fixedCost / byteCost : SIZE_MAX;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        const ProbeRegion &r = regions[plan.order[i]];
+        if (r.size == 0)
+            continue;
+
+        // The probe reads whole words anyway
+        size_t start = r.address & ~(size_t)3;
+        size_t end = (r.address + r.size + 3) & ~(size_t)3;
+
+        if (!plan.transfers.empty())
+        {
+            Transfer &t = plan.transfers.back();
+            size_t t_end = t.address + t.size;
+            if (start <= t_end || start - t_end <= max_gap)
+            {
+                if (end > t_end)
+                    t.size = end - t.address;
+                t.last = i + 1;
+                continue;
+            }
+        }
+
+        Transfer t;
+        t.address = start;
+        t.size = end - start;
+        t.first = i;
+        t.last = i + 1;
+        plan.transfers.push_back(t);
+    }
+}
+
+bool Probe::readv(const ProbeRegion *regions, size_t count)
+{
+    planReads(regions, count, getFixedCost(), getByteCost(), plan);
+
+    for (const Transfer &t : plan.transfers)
+    {
+        const ProbeRegion &r = regions[plan.order[t.first]];
+
+        // A single region is read straight into place
+        if (t.last - t.first == 1)
+        {
+            if (!read(r.ptr, r.address, r.size))
+                return false;
+        }
+        else
+        {
+            readvBuffer.resize(t.size);
+            if (!read(readvBuffer.data(), t.address, t.size))
+                return false;
+
+            for (size_t i = t.first; i < t.last; i++)
+            {
+                const ProbeRegion &s = regions[plan.order[i]];
+                memcpy(s.ptr, readvBuffer.data() + (s.address - t.address),
+                       s.size);
+            }
+        }
+    }
+
+    readvRegions += count;
+    readvTransfers += plan.transfers.size();
+
+    return true;
+}
+
+int Probe::pollChannels(Channel *const *channels, size_t count)
+{
+    const size_t size = Channel::HEADER_SIZE;
+    statusBuffer.resize(count * size);
+    statusRegions.resize(count);
+    for (size_t i = 0; i < count; i++)
+    {
+        statusRegions[i].ptr = &statusBuffer[i * size];
+        statusRegions[i].address = channels[i]->getAddress();
+        statusRegions[i].size = size;
+    }
+
+    if (!readv(statusRegions))
+        return -1;
+
+    bool active = false;
+    for (size_t i = 0; i < count; i++)
+    {
+        int res = channels[i]->poll(&statusBuffer[i * size]);
+        if (res < 0)
+            return -1;
+
+        active |= (res > 0);
+    }
+
+    return active;
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <vector>
+
+class Channel;
+
+// One part of a scattered read
+struct ProbeRegion
+{
+    uint8_t *ptr;
+    size_t address;
+    size_t size;
+};
+
+// Access to target memory through a debug probe. Implemented by STLink and
+// by the record and replay backends
+class Probe
+{
+public:
+    // A transfer made by readv() covering regions order[first] to
+    // order[last - 1] of a plan
+    struct Transfer
+    {
+        size_t address;
+        size_t size;
+        size_t first;
+        size_t last;
+    };
+
+    struct ReadPlan
+    {
+        // Regions by address
+        std::vector<size_t> order;
+        std::vector<Transfer> transfers;
+    };
+
+    Probe();
+    virtual ~Probe() {}
+
+    virtual bool read(uint8_t *ptr, size_t address, size_t size) = 0;
+    virtual bool write(uint8_t *ptr, size_t address, size_t size) = 0;
+
+    // Read several regions in as few transfers as possible. Neighbouring
+    // regions are read together with the gap between them when reading
+    // the gap costs less than another transfer
+    virtual bool readv(const ProbeRegion *regions, size_t count);
+    bool readv(const std::vector<ProbeRegion> &regions)
+    {
+        return readv(regions.data(), regions.size());
+    }
+
+    // Work out the word aligned transfers readv() makes
+    static void planReads(const ProbeRegion *regions, size_t count,
+                          double fixedCost, double byteCost, ReadPlan &plan);
+
+    // Service channels on this probe once. Returns 1 if any moved data, 0
+    // if all were idle or -1 on error. The magic numbers and status words
+    // are read together with readv() and the ring protocol run here. A
+    // probe shared through a ProbeServer has the server do this instead
+    virtual int pollChannels(Channel *const *channels, size_t count);
+
+    // Open the same probe again after it has been unplugged. Returns false
+    // if it is not back yet
+    virtual bool canReconnect() const { return false; }
+    virtual bool reconnect() { return false; }
+
+    virtual void getRAM(size_t &base, size_t &size) = 0;
+    virtual void getFlash(size_t &base, size_t &size) = 0;
+
+    // A transfer of n bytes takes about fixed + perByte * n seconds. Used
+    // to decide when reading bytes that are not needed saves a transfer
+    virtual double getFixedCost() const { return 1e-3; }
+    virtual double getByteCost() const { return 1e-6; }
+
+    // Regions asked for and transfers made by readv(). The difference is
+    // the number of transfers saved
+    unsigned long getReadvRegions() const { return readvRegions; }
+    unsigned long getReadvTransfers() const { return readvTransfers; }
+
+protected:
+    ReadPlan plan;
+    std::vector<uint8_t> readvBuffer;
+    unsigned long readvRegions;
+    unsigned long readvTransfers;
+    std::vector<uint8_t> statusBuffer;
+    std::vector<ProbeRegion> statusRegions;
+};
@@ -0,0 +1,549 @@
+#include "ProbeServer.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <algorithm>
+
+// Most reads taken from one client in a round so a client with a long
+// queue does not hold up the others
+#define PROBE_BATCH_READS 64
+
+// Stop reading requests from a client that is not reading the responses
+#define PROBE_MAX_BUFFERED (4 * PROBE_MAX_TRANSFER)
+
+// Polls retried before reopening the probe after an error
+#define PROBE_RETRIES 10
+// Time between attempts to reopen the probe
+#define PROBE_RECONNECT_MS 250
+
+typedef std::chrono::steady_clock Clock;
+
+static bool setNonBlocking(int fd)
+{
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags == -1 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1)
+    {
+        perror("fcntl");
+        return false;
+    }
+
+    return true;
+}
+
+ProbeServer::ProbeServer(Probe &probe_)
+    : probe(probe_),
+      listenFd(-1),
+      running(true),
+      idleSleep(1000),
+      activeChanged(false),
+      failures(0),
+      reconnecting(false),
+      totalClients(0),
+      reads(0),
+      batches(0),
+      outputBytes(0)
+{
+}
+
+ProbeServer::~ProbeServer()
+{
+    close();
+}
+
+bool ProbeServer::open(const std::string &path_)
+{
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path_.size() >= sizeof(addr.sun_path))
+    {
+        fprintf(stderr, "Socket path too long: %s\n", path_.c_str());
+        return false;
+    }
+    strcpy(addr.sun_path, path_.c_str());
+
+    listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listenFd < 0)
+    {
+        perror("socket");
+        return false;
+    }
+
+    // A socket left behind by a server that died can be replaced but not
+    // one that is still in use
+    if (connect(listenFd, (struct sockaddr *)&addr, sizeof(addr)) == 0)
+    {
+        fprintf(stderr, "A probe server is already running on %s\n",
+                path_.c_str());
+        close();
+        return false;
+    }
+    unlink(path_.c_str());
+
+    if (bind(listenFd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        listen(listenFd, 16) != 0)
+    {
+        perror(path_.c_str());
+        close();
+        return false;
+    }
+
+    if (!setNonBlocking(listenFd))
+    {
+        close();
+        return false;
+    }
+
+    path = path_;
+    return true;
+}
+
+void ProbeServer::close()
+{
+    while (!clients.empty())
+        disconnect(clients.size() - 1);
+
+    if (listenFd >= 0)
+    {
+        ::close(listenFd);
+        listenFd = -1;
+    }
+
+    if (!path.empty())
+    {
+        unlink(path.c_str());
+        path.clear();
+    }
+}
+
+bool ProbeServer::run(std::function<bool ()> hook)
+{
+    running = true;
+    bool busy = false;
+    while (running)
+    {
+        if (!waitIO(busy ? 0 : (idleSleep + 999) / 1000))
+            return false;
+
+        if (activeChanged)
+        {
+            active.clear();
+            for (auto &s : subscriptions)
+                active.push_back(s.second.channel.get());
+            activeChanged = false;
+        }
+
+        busy = false;
+
+        // Console output first
+        if (!active.empty())
+        {
+            int res = probe.pollChannels(active.data(), active.size());
+            if (res < 0)
+            {
+                if (!recover())
+                    return false;
+            }
+            else
+            {
+                if (reconnecting)
+                {
+                    fprintf(stderr, "Probe reconnected\n");
+                    reconnecting = false;
+                }
+
+                failures = 0;
+                busy |= (res > 0);
+            }
+        }
+
+        serveReads();
+
+        for (size_t i = 0; i < clients.size(); i++)
+        {
+            serveOther(*clients[i]);
+            busy |= !clients[i]->requests.empty();
+        }
+
+        // Send what is ready now rather than waiting for the next poll
+        for (size_t i = clients.size(); i-- > 0; )
+            if (!send(*clients[i]))
+                disconnect(i);
+
+        if (hook && !hook())
+            break;
+    }
+
+    return true;
+}
+
+// After a failed poll of the control blocks first just poll again for a
+// while and then try to reopen the probe every PROBE_RECONNECT_MS. Returns
+// false if the probe cannot be reopened
+bool ProbeServer::recover()
+{
+    if (++failures <= PROBE_RETRIES)
+        return true;
+
+    if (!probe.canReconnect())
+    {
+        fprintf(stderr, "Probe error while polling channels\n");
+        return false;
+    }
+
+    if (!reconnecting)
+    {
+        fprintf(stderr, "Lost the probe, reconnecting\n");
+        reconnecting = true;
+        nextReconnect = Clock::now();
+    }
+
+    Clock::time_point now = Clock::now();
+    if (now >= nextReconnect)
+    {
+        nextReconnect = now + std::chrono::milliseconds(PROBE_RECONNECT_MS);
+        probe.reconnect();
+    }
+
+    return true;
+}
+
+// Wait up to timeout_ms for a new client, requests or space to send
+// responses. Returns false on error
+bool ProbeServer::waitIO(int timeout_ms)
+{
+    std::vector<struct pollfd> fds(clients.size() + 1);
+    fds[0].fd = listenFd;
+    fds[0].events = POLLIN;
+    for (size_t i = 0; i < clients.size(); i++)
+    {
+        Client &c = *clients[i];
+        size_t buffered = c.out.size() - c.outPos;
+
+        fds[i + 1].fd = c.fd;
+        fds[i + 1].events = 0;
+        if (buffered < PROBE_MAX_BUFFERED)
+            fds[i + 1].events |= POLLIN;
+        if (buffered > 0)
+            fds[i + 1].events |= POLLOUT;
+    }
+
+    int res = poll(fds.data(), fds.size(), timeout_ms);
+    if (res < 0)
+    {
+        // Interrupted by a signal that may have stopped the server
+        if (errno == EINTR)
+            return true;
+
+        perror("poll");
+        return false;
+    }
+
+    // Go backwards so a disconnect does not move the ones still to check
+    for (size_t i = clients.size(); i-- > 0; )
+    {
+        short revents = fds[i + 1].revents;
+        if ((revents & (POLLIN | POLLHUP | POLLERR)) &&
+            !receive(*clients[i]))
+            disconnect(i);
+        else if ((revents & POLLOUT) && !send(*clients[i]))
+            disconnect(i);
+    }
+
+    if (fds[0].revents & POLLIN)
+    {
+        int fd;
+        while ((fd = accept(listenFd, nullptr, nullptr)) >= 0)
+        {
+            if (!setNonBlocking(fd))
+            {
+                ::close(fd);
+                continue;
+            }
+
+            std::unique_ptr<Client> c(new Client());
+            c->fd = fd;
+            c->outPos = 0;
+            clients.push_back(std::move(c));
+            totalClients++;
+        }
+    }
+
+    return true;
+}
+
+// Read what the client has sent and split it into requests. Returns false
+// if the client has gone or sent something invalid
+bool ProbeServer::receive(Client &c)
+{
+    uint8_t buf[65536];
+    ssize_t n = recv(c.fd, buf, sizeof(buf), MSG_DONTWAIT);
+    if (n == 0)
+        return false;
+    if (n < 0)
+        return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+
+    c.in.insert(c.in.end(), buf, buf + n);
+
+    size_t pos = 0;
+    while (c.in.size() - pos >= sizeof(ProbeMessage))
+    {
+        ProbeMessage h;
+        memcpy(&h, &c.in[pos], sizeof(h));
+        if (h.size > PROBE_MAX_TRANSFER)
+        {
+            fprintf(stderr, "Request of %u bytes is too large\n", h.size);
+            return false;
+        }
+
+        size_t data_size = h.type == PROBE_MSG_READ ? 0 : h.size;
+        if (c.in.size() - pos - sizeof(h) < data_size)
+            break;
+
+        c.requests.emplace_back();
+        Request &r = c.requests.back();
+        r.header = h;
+        const uint8_t *data = &c.in[pos + sizeof(h)];
+        r.data.assign(data, data + data_size);
+
+        pos += sizeof(h) + data_size;
+    }
+
+    c.in.erase(c.in.begin(), c.in.begin() + pos);
+
+    return true;
+}
+
+// Send as much of the buffered output as the socket takes. Returns false if
+// the client has gone
+bool ProbeServer::send(Client &c)
+{
+    while (c.outPos < c.out.size())
+    {
+        ssize_t n = ::send(c.fd, c.out.data() + c.outPos,
+                           c.out.size() - c.outPos,
+                           MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (n < 0)
+            return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+
+        c.outPos += n;
+    }
+
+    c.out.clear();
+    c.outPos = 0;
+
+    return true;
+}
+
+void ProbeServer::disconnect(size_t i)
+{
+    Client *c = clients[i].get();
+
+    // Stop draining control blocks nobody is reading so the target keeps
+    // the output for the next subscriber
+    for (auto s = subscriptions.begin(); s != subscriptions.end(); )
+    {
+        std::vector<Client *> &sc = s->second.clients;
+        sc.erase(std::remove(sc.begin(), sc.end(), c), sc.end());
+        if (sc.empty())
+        {
+            s = subscriptions.erase(s);
+            activeChanged = true;
+        }
+        else
+            ++s;
+    }
+
+    ::close(c->fd);
+    clients.erase(clients.begin() + i);
+}
+
+void ProbeServer::respond(Client &c, const ProbeMessage &request,
+                          uint8_t status, const uint8_t *data, size_t size)
+{
+    ProbeMessage h = request;
+    h.status = status;
+    h.size = size;
+
+    const uint8_t *p = (const uint8_t *)&h;
+    c.out.insert(c.out.end(), p, p + sizeof(h));
+    if (size > 0)
+        c.out.insert(c.out.end(), data, data + size);
+}
+
+// Make the reads at the front of every client's queue together
+void ProbeServer::serveReads()
+{
+    regions.clear();
+    batch.assign(clients.size(), 0);
+
+    for (size_t i = 0; i < clients.size(); i++)
+    {
+        Client &c = *clients[i];
+        if (c.out.size() - c.outPos >= PROBE_MAX_BUFFERED)
+            continue;
+
+        for (Request &r : c.requests)
+        {
+            if (r.header.type != PROBE_MSG_READ ||
+                batch[i] == PROBE_BATCH_READS)
+                break;
+
+            r.data.resize(r.header.size);
+
+            ProbeRegion region;
+            region.ptr = r.data.data();
+            region.address = r.header.address;
+            region.size = r.header.size;
+            regions.push_back(region);
+            batch[i]++;
+        }
+    }
+
+    if (regions.empty())
+        return;
+
+    // If any read fails try them one at a time so only the bad ones fail
+    bool ok = probe.readv(regions);
+    batches++;
+    reads += regions.size();
+
+    for (size_t i = 0; i < clients.size(); i++)
+    {
+        Client &c = *clients[i];
+        for (size_t k = 0; k < batch[i]; k++)
+        {
+            Request &r = c.requests.front();
+            bool res = ok || probe.read(r.data.data(), r.header.address,
+                                        r.header.size);
+            if (res)
+                respond(c, r.header, PROBE_STATUS_OK, r.data.data(),
+                        r.data.size());
+            else
+                respond(c, r.header, PROBE_STATUS_ERROR);
+
+            c.requests.pop_front();
+        }
+    }
+}
+
+// Do the requests at the front of the queue up to the next read
+void ProbeServer::serveOther(Client &c)
+{
+    while (!c.requests.empty() &&
+           c.requests.front().header.type != PROBE_MSG_READ)
+    {
+        Request &r = c.requests.front();
+        switch (r.header.type)
+        {
+        case PROBE_MSG_INFO:
+        {
+            size_t ram_base, ram_size, flash_base, flash_size;
+            probe.getRAM(ram_base, ram_size);
+            probe.getFlash(flash_base, flash_size);
+            uint32_t info[6] = {
+                (uint32_t)ram_base, (uint32_t)ram_size,
+                (uint32_t)flash_base, (uint32_t)flash_size,
+                (uint32_t)(probe.getFixedCost() * 1e9 + 0.5),
+                (uint32_t)(probe.getByteCost() * 1e12 + 0.5) };
+            respond(c, r.header, PROBE_STATUS_OK, (const uint8_t *)info,
+                    sizeof(info));
+            break;
+        }
+
+        case PROBE_MSG_WRITE:
+            respond(c, r.header,
+                    probe.write(r.data.data(), r.header.address,
+                                r.data.size()) ?
+                    PROBE_STATUS_OK : PROBE_STATUS_ERROR);
+            break;
+
+        case PROBE_MSG_SUBSCRIBE:
+            subscribe(c, r);
+            break;
+
+        case PROBE_MSG_INPUT:
+        {
+            auto s = subscriptions.find(r.header.address);
+            if (s != subscriptions.end())
+                s->second.channel->write(r.data.data(), r.data.size());
+            break;
+        }
+
+        default:
+            respond(c, r.header, PROBE_STATUS_ERROR);
+            break;
+        }
+
+        c.requests.pop_front();
+    }
+}
+
+void ProbeServer::subscribe(Client &c, const Request &r)
+{
+    size_t address = r.header.address;
+
+    auto s = subscriptions.find(address);
+    if (s != subscriptions.end())
+    {
+        std::vector<Client *> &sc = s->second.clients;
+        if (std::find(sc.begin(), sc.end(), &c) == sc.end())
+            sc.push_back(&c);
+
+        respond(c, r.header, PROBE_STATUS_OK);
+        return;
+    }
+
+    // Check there is a control block there before draining it
+    uint8_t buf[4];
+    if (!probe.read(buf, address, sizeof(buf)))
+    {
+        respond(c, r.header, PROBE_STATUS_ERROR);
+        return;
+    }
+
+    Channel::Location l;
+    l.address = address;
+    l.magic = buf[0] | (buf[1] << 8) | (buf[2] << 16) |
+        ((uint32_t)buf[3] << 24);
+    if (l.magic != SWDSTREAM_MAGIC && l.magic != SWDPRINT_MAGIC)
+    {
+        respond(c, r.header, PROBE_STATUS_ERROR);
+        return;
+    }
+
+    Subscription &sub = subscriptions[address];
+    sub.channel.reset(new Channel(probe, l));
+    sub.clients.push_back(&c);
+    sub.channel->setReadCallback([this, address](const uint8_t *data,
+                                                 size_t size) {
+        notify(address, PROBE_MSG_OUTPUT, data, size);
+        outputBytes += size;
+    });
+    sub.channel->setResetCallback([this, address]() {
+        notify(address, PROBE_MSG_RESET);
+    });
+    activeChanged = true;
+
+    respond(c, r.header, PROBE_STATUS_OK);
+}
+
+// Send a message about the control block at address to its subscribers
+void ProbeServer::notify(size_t address, uint8_t type, const uint8_t *data,
+                         size_t size)
+{
+    ProbeMessage h;
+    memset(&h, 0, sizeof(h));
+    h.type = type;
+    h.address = address;
+
+    for (Client *sc : subscriptions[address].clients)
+        respond(*sc, h, PROBE_STATUS_OK, data, size);
+}
@@ -0,0 +1,159 @@
+#pragma once
+
+#include "Channel.h"
+#include "Probe.h"
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Only one process can open an ST-Link so the probe server owns it and
+// other tools share it through a Unix socket. Each message in either
+// direction is a ProbeMessage header followed by size bytes of data, apart
+// from a read request where size is the number of bytes to read. Both ends
+// are on the same host so the header is sent in native byte order.
+//
+//   PROBE_MSG_INFO       response data is the RAM and flash base and size
+//                        and the transfer costs in nanoseconds and
+//                        picoseconds per byte as 32 bit words
+//   PROBE_MSG_READ       response data is size bytes from address
+//   PROBE_MSG_WRITE      data is written to address
+//   PROBE_MSG_SUBSCRIBE  output of the control block at address is sent
+//                        as PROBE_MSG_OUTPUT messages with id 0
+//   PROBE_MSG_INPUT      data is queued as input to the control block at
+//                        address. There is no response
+//   PROBE_MSG_RESET      sent to subscribers with id 0 when the target
+//                        restarts, in order with the output of the control
+//                        block at address
+//
+// Every other request gets a response with the same type and id and a
+// status of PROBE_STATUS_OK or PROBE_STATUS_ERROR. Responses to one client
+// are in the order of its requests.
+#define PROBE_SERVER_SOCKET "/tmp/swdprobe.sock"
+
+#define PROBE_MSG_INFO      1
+#define PROBE_MSG_READ      2
+#define PROBE_MSG_WRITE     3
+#define PROBE_MSG_SUBSCRIBE 4
+#define PROBE_MSG_INPUT     5
+#define PROBE_MSG_OUTPUT    6
+#define PROBE_MSG_RESET     7
+
+#define PROBE_STATUS_OK    0
+#define PROBE_STATUS_ERROR 1
+
+// Largest read or write in one request
+#define PROBE_MAX_TRANSFER (1 << 20)
+
+struct ProbeMessage
+{
+    uint8_t type;
+    uint8_t status;
+    uint16_t reserved;
+    uint32_t id;
+    uint32_t address;
+    uint32_t size;
+};
+
+// Serves requests from all the clients in rounds. Each round first drains
+// the subscribed control blocks so console output is never held up behind
+// other tools. Then the reads at the front of every client's queue are
+// made with one Probe::readv() so reads of nearby memory by different
+// clients share transfers. Then the other requests up to the next read of
+// each client are done in order.
+//
+// Transfers fail while the target is held in reset so a failed poll of the
+// control blocks is retried for a short time and then the probe is reopened
+// until it is back. Clients are still served in between and their requests
+// fail until then.
+class ProbeServer
+{
+public:
+    ProbeServer(Probe &probe);
+    ~ProbeServer();
+
+    bool open(const std::string &path);
+    void close();
+
+    // Serve until stop() is called, the hook returns false or there is an
+    // error that cannot be recovered from. Returns false on error
+    bool run(std::function<bool ()> hook = nullptr);
+    void stop() { running = false; }
+
+    void setIdleSleep(unsigned int us) { idleSleep = us; }
+
+    unsigned long getClients() const { return totalClients; }
+    unsigned long getReads() const { return reads; }
+    unsigned long getBatches() const { return batches; }
+    unsigned long getOutputBytes() const { return outputBytes; }
+
+protected:
+    struct Request
+    {
+        ProbeMessage header;
+        std::vector<uint8_t> data;
+    };
+
+    struct Client
+    {
+        int fd;
+        // Received bytes not yet parsed into requests
+        std::vector<uint8_t> in;
+        std::deque<Request> requests;
+        // Responses not yet sent
+        std::vector<uint8_t> out;
+        size_t outPos;
+    };
+
+    // A control block with at least one subscriber
+    struct Subscription
+    {
+        std::unique_ptr<Channel> channel;
+        std::vector<Client *> clients;
+    };
+
+    Probe &probe;
+    std::string path;
+    int listenFd;
+    volatile bool running;
+    unsigned int idleSleep;
+
+    std::vector<std::unique_ptr<Client>> clients;
+    std::map<size_t, Subscription> subscriptions;
+    std::vector<Channel *> active;
+    bool activeChanged;
+
+    // Failed polls in a row and when to next try to reopen the probe
+    unsigned int failures;
+    bool reconnecting;
+    std::chrono::steady_clock::time_point nextReconnect;
+
+    std::vector<ProbeRegion> regions;
+    // Reads in the batch from each client
+    std::vector<size_t> batch;
+
+    unsigned long totalClients;
+    unsigned long reads;
+    unsigned long batches;
+    unsigned long outputBytes;
+
+    bool waitIO(int timeout_ms);
+    bool recover();
+    bool receive(Client &c);
+    bool send(Client &c);
+    void disconnect(size_t i);
+    void respond(Client &c, const ProbeMessage &request, uint8_t status,
+                 const uint8_t *data = nullptr, size_t size = 0);
+    void serveReads();
+    void serveOther(Client &c);
+    void subscribe(Client &c, const Request &r);
+    void notify(size_t address, uint8_t type, const uint8_t *data = nullptr,
+                size_t size = 0);
+};
@@ -0,0 +1,123 @@
+#include "Profile.h"
+
+#include <string.h>
+
+// Entries in a sane table
+#define MAX_ENTRIES 256
+// Longest name read from the target
+#define MAX_NAME 64
+
+static uint32_t getWord(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+Profile::Profile()
+    : address(0),
+      count(0)
+{
+}
+
+bool Profile::find(Probe &probe)
+{
+    size_t ram_base, ram_size;
+    probe.getRAM(ram_base, ram_size);
+
+    std::vector<uint8_t> ram;
+    ram.resize(ram_size);
+
+    if (!probe.read(ram.data(), ram_base, ram_size))
+    {
+        fprintf(stderr, "Could not read ram\n");
+        return false;
+    }
+
+    for (size_t i = 0; i + HEADER_SIZE <= ram_size; i += 4)
+    {
+        if (getWord(&ram[i]) != SWDPROFILE_MAGIC)
+            continue;
+
+        uint32_t n = getWord(&ram[i + 4]);
+        if (n == 0 || n > MAX_ENTRIES ||
+            i + HEADER_SIZE + n * ENTRY_SIZE > ram_size)
+            continue;
+
+        address = ram_base + i;
+        count = n;
+        names.clear();
+        return true;
+    }
+
+    return false;
+}
+
+bool Profile::readName(Probe &probe, size_t name_address, std::string &name)
+{
+    // Usually in flash so read a block rather than a byte at a time
+    uint8_t buf[MAX_NAME];
+    if (!probe.read(buf, name_address, sizeof(buf)))
+        return false;
+
+    name.assign((const char *)buf, strnlen((const char *)buf, sizeof(buf)));
+    return true;
+}
+
+bool Profile::read(Probe &probe, std::vector<Entry> &entries)
+{
+    if (count == 0)
+        return false;
+
+    size_t size = HEADER_SIZE + count * ENTRY_SIZE;
+    std::vector<uint8_t> table(size), check(size);
+
+    if (!probe.read(table.data(), address, size))
+        return false;
+
+    for (int tries = 0; tries < 10; tries++)
+    {
+        if (!probe.read(check.data(), address, size))
+            return false;
+
+        if (table == check)
+            break;
+
+        table.swap(check);
+    }
+
+    // Names do not change so are only read once
+    if (names.empty())
+    {
+        names.resize(count);
+        for (uint32_t i = 0; i < count; i++)
+        {
+            size_t p = getWord(&table[HEADER_SIZE + i * ENTRY_SIZE]);
+            if (!readName(probe, p, names[i]))
+                names[i] = "?";
+        }
+    }
+
+    entries.resize(count);
+    for (uint32_t i = 0; i < count; i++)
+    {
+        const uint8_t *e = &table[HEADER_SIZE + i * ENTRY_SIZE];
+        entries[i].name = names[i];
+        entries[i].calls = getWord(e + 4);
+        entries[i].min = getWord(e + 8);
+        entries[i].max = getWord(e + 12);
+        entries[i].total = getWord(e + 16) |
+            ((uint64_t)getWord(e + 20) << 32);
+    }
+
+    return true;
+}
+
+void Profile::print(FILE *fp, const std::vector<Entry> &entries)
+{
+    fprintf(fp, "%-32s %10s %10s %10s %10s %14s\n", "function", "calls", "min",
+            "avg", "max", "total");
+    for (const Entry &e : entries)
+        fprintf(fp, "%-32s %10u %10u %10.1f %10u %14llu\n", e.name.c_str(),
+                e.calls, e.min,
+                e.calls > 0 ? (double)e.total / e.calls : 0.0, e.max,
+                (unsigned long long)e.total);
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include "Probe.h"
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <string>
+#include <vector>
+
+#define SWDPROFILE_MAGIC 0xd5715e0f
+
+// Host side of the SWD_PROFILE cycle count table. See src/SWDProfile.h for
+// the layout
+class Profile
+{
+public:
+    static const size_t HEADER_SIZE = 8;
+    static const size_t ENTRY_SIZE = 24;
+
+    struct Entry
+    {
+        std::string name;
+        uint32_t calls;
+        uint32_t min;
+        uint32_t max;
+        uint64_t total;
+    };
+
+    Profile();
+
+    // Search target RAM for the table
+    bool find(Probe &probe);
+
+    // Read every entry. The table is read until two reads agree so the 64
+    // bit totals are not torn
+    bool read(Probe &probe, std::vector<Entry> &entries);
+
+    static void print(FILE *fp, const std::vector<Entry> &entries);
+
+protected:
+    size_t address;
+    uint32_t count;
+    std::vector<std::string> names;
+
+    bool readName(Probe &probe, size_t address, std::string &name);
+};
@@ -0,0 +1,324 @@
+#include "Recording.h"
+
+#include <string.h>
+
+#include <fstream>
+#include <iterator>
+#include <thread>
+
+#define SIGNATURE_SIZE 8
+#define HEADER_SIZE (SIGNATURE_SIZE + 6 * 4)
+
+static void putWord(uint8_t *p, uint32_t v)
+{
+    for (int i = 0; i < 4; i++)
+        p[i] = v >> (i * 8);
+}
+
+static uint32_t getWord(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+RecordingProbe::RecordingProbe(Probe &probe_)
+    : probe(probe_),
+      fp(nullptr)
+{
+    fixedCostNs = probe.getFixedCost() * 1e9 + 0.5;
+    byteCostPs = probe.getByteCost() * 1e12 + 0.5;
+    fixedCost = fixedCostNs * 1e-9;
+    byteCost = byteCostPs * 1e-12;
+}
+
+RecordingProbe::~RecordingProbe()
+{
+    close();
+}
+
+bool RecordingProbe::open(const std::string &filename)
+{
+    fp = fopen(filename.c_str(), "wb");
+    if (fp == nullptr)
+    {
+        perror(filename.c_str());
+        return false;
+    }
+
+    // Polling produces many small records so buffer generously
+    setvbuf(fp, nullptr, _IOFBF, 1 << 20);
+
+    size_t ram_base, ram_size, flash_base, flash_size;
+    probe.getRAM(ram_base, ram_size);
+    probe.getFlash(flash_base, flash_size);
+
+    uint8_t header[HEADER_SIZE] = {};
+    memcpy(header, RECORDING_SIGNATURE, sizeof(RECORDING_SIGNATURE));
+    putWord(header + SIGNATURE_SIZE, ram_base);
+    putWord(header + SIGNATURE_SIZE + 4, ram_size);
+    putWord(header + SIGNATURE_SIZE + 8, flash_base);
+    putWord(header + SIGNATURE_SIZE + 12, flash_size);
+    putWord(header + SIGNATURE_SIZE + 16, fixedCostNs);
+    putWord(header + SIGNATURE_SIZE + 20, byteCostPs);
+    fwrite(header, 1, sizeof(header), fp);
+
+    last = Clock::now();
+    return true;
+}
+
+void RecordingProbe::close()
+{
+    if (fp != nullptr)
+    {
+        fclose(fp);
+        fp = nullptr;
+    }
+}
+
+bool RecordingProbe::read(uint8_t *ptr, size_t address, size_t size)
+{
+    bool res = probe.read(ptr, address, size);
+    record(res ? 0 : RECORD_FAILED, ptr, address, size);
+    return res;
+}
+
+bool RecordingProbe::write(uint8_t *ptr, size_t address, size_t size)
+{
+    bool res = probe.write(ptr, address, size);
+    record(RECORD_WRITE | (res ? 0 : RECORD_FAILED), ptr, address, size);
+    return res;
+}
+
+bool RecordingProbe::reconnect()
+{
+    bool res = probe.reconnect();
+    record(RECORD_RECONNECT | (res ? 0 : RECORD_FAILED), nullptr, 0, 0);
+    return res;
+}
+
+void RecordingProbe::getRAM(size_t &base, size_t &size)
+{
+    probe.getRAM(base, size);
+}
+
+void RecordingProbe::getFlash(size_t &base, size_t &size)
+{
+    probe.getFlash(base, size);
+}
+
+// Timestamps are taken when the transfer completes
+void RecordingProbe::record(uint8_t type, const uint8_t *ptr, size_t address,
+                            size_t size)
+{
+    if (fp == nullptr)
+        return;
+
+    Clock::time_point now = Clock::now();
+    uint64_t delay = std::chrono::duration_cast<std::chrono::microseconds>(
+        now - last).count();
+    // Keep the remainder so rounding does not accumulate
+    last += std::chrono::microseconds(delay);
+
+    fputc(type, fp);
+    putVarint(delay);
+    putVarint(address);
+    putVarint(size);
+
+    // A failed read has no data worth keeping
+    if (type != RECORD_FAILED && size != 0)
+        fwrite(ptr, 1, size, fp);
+}
+
+void RecordingProbe::putVarint(uint64_t v)
+{
+    while (v >= 0x80)
+    {
+        fputc((v & 0x7f) | 0x80, fp);
+        v >>= 7;
+    }
+
+    fputc(v, fp);
+}
+
+ReplayProbe::ReplayProbe()
+    : pos(0),
+      time(0),
+      realTime(false),
+      started(false),
+      transfers(0),
+      skipped(0),
+      mismatches(0),
+      misses(0)
+{
+    ram[0] = ram[1] = 0;
+    flash[0] = flash[1] = 0;
+    fixedCost = Probe::getFixedCost();
+    byteCost = Probe::getByteCost();
+}
+
+bool ReplayProbe::open(const std::string &filename)
+{
+    std::ifstream file(filename, std::ios::binary);
+    if (!file)
+    {
+        perror(filename.c_str());
+        return false;
+    }
+
+    data.assign(std::istreambuf_iterator<char>(file),
+                std::istreambuf_iterator<char>());
+
+    if (data.size() < HEADER_SIZE ||
+        memcmp(data.data(), RECORDING_SIGNATURE,
+               sizeof(RECORDING_SIGNATURE)) != 0)
+    {
+        fprintf(stderr, "%s is not a probe recording\n", filename.c_str());
+        return false;
+    }
+
+    ram[0] = getWord(&data[SIGNATURE_SIZE]);
+    ram[1] = getWord(&data[SIGNATURE_SIZE + 4]);
+    flash[0] = getWord(&data[SIGNATURE_SIZE + 8]);
+    flash[1] = getWord(&data[SIGNATURE_SIZE + 12]);
+    fixedCost = getWord(&data[SIGNATURE_SIZE + 16]) * 1e-9;
+    byteCost = getWord(&data[SIGNATURE_SIZE + 20]) * 1e-12;
+
+    pos = HEADER_SIZE;
+    time = 0;
+    started = false;
+    misses = 0;
+    return true;
+}
+
+bool ReplayProbe::getVarint(size_t &p, uint64_t &v) const
+{
+    v = 0;
+    for (int shift = 0; shift < 64; shift += 7)
+    {
+        if (p >= data.size())
+            return false;
+
+        uint8_t b = data[p++];
+        v |= (uint64_t)(b & 0x7f) << shift;
+        if (!(b & 0x80))
+            return true;
+    }
+
+    return false;
+}
+
+// Decode the record at p which follows one at time t. On success p is moved
+// past the record
+bool ReplayProbe::parse(size_t &p, Record &r, uint64_t t) const
+{
+    if (p >= data.size())
+        return false;
+
+    r.type = data[p++];
+
+    uint64_t delay, address, size;
+    if (!getVarint(p, delay) || !getVarint(p, address) || !getVarint(p, size))
+        return false;
+
+    r.time = t + delay;
+    r.address = address;
+    r.size = size;
+    r.data = nullptr;
+
+    if (r.type != RECORD_FAILED)
+    {
+        if (size > data.size() - p)
+            return false;
+
+        r.data = &data[p];
+        p += size;
+    }
+
+    return true;
+}
+
+bool ReplayProbe::read(uint8_t *ptr, size_t address, size_t size)
+{
+    if (!started)
+    {
+        start = Clock::now();
+        started = true;
+    }
+
+    if (atEnd())
+        return false;
+
+    size_t p = pos;
+    uint64_t t = time;
+    size_t skip = 0;
+    Record r;
+    while (skip < REPLAY_LOOKAHEAD && parse(p, r, t))
+    {
+        t = r.time;
+        if (!(r.type & (RECORD_WRITE | RECORD_RECONNECT)) &&
+            r.address == address && r.size == size)
+        {
+            pos = p;
+            time = t;
+            transfers++;
+            skipped += skip;
+            misses = 0;
+
+            if (realTime)
+                std::this_thread::sleep_until(
+                    start + std::chrono::microseconds(time));
+
+            if (r.type & RECORD_FAILED)
+                return false;
+
+            memcpy(ptr, r.data, size);
+            return true;
+        }
+
+        skip++;
+    }
+
+    // Not in the recording near here, such as a read that readv() merged
+    // differently or one that failed without being recorded
+    mismatches++;
+    if (++misses >= REPLAY_MAX_MISSES)
+    {
+        fprintf(stderr, "Replay has lost step with the recording\n");
+        pos = data.size();
+    }
+
+    return false;
+}
+
+bool ReplayProbe::write(uint8_t * /*ptr*/, size_t address, size_t size)
+{
+    if (!started)
+    {
+        start = Clock::now();
+        started = true;
+    }
+
+    // Stay in step if this write was also in the recording
+    size_t p = pos;
+    Record r;
+    if (parse(p, r, time) && (r.type & RECORD_WRITE) &&
+        r.address == address && r.size == size)
+    {
+        pos = p;
+        time = r.time;
+        transfers++;
+    }
+
+    return true;
+}
+
+void ReplayProbe::getRAM(size_t &base, size_t &size)
+{
+    base = ram[0];
+    size = ram[1];
+}
+
+void ReplayProbe::getFlash(size_t &base, size_t &size)
+{
+    base = flash[0];
+    size = flash[1];
+}
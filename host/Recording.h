@@ -0,0 +1,142 @@
+#pragma once
+
+#include "Probe.h"
+
+#include <stdio.h>
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+// Probe traffic can be captured to a file and played back later without any
+// hardware. The file starts with an 8 byte signature followed by the RAM and
+// flash base and size and the transfer costs in nanoseconds and picoseconds
+// per byte as little endian 32 bit words. The costs are needed so the replay
+// makes the same choice of transfers as the recording. Each transfer is then
+//
+//   type     1 byte, RECORD_WRITE, RECORD_FAILED and RECORD_RECONNECT flags
+//   delay    varint, microseconds since the previous transfer
+//   address  varint
+//   size     varint
+//   data     size bytes, absent for a failed read
+//
+// Varints are 7 bits per byte least significant first with the top bit set
+// on every byte but the last. A reopen of the probe is recorded with the
+// RECORD_RECONNECT flag, an address and size of 0 and no data.
+#define RECORDING_SIGNATURE "SWDREC\x02"
+
+#define RECORD_WRITE     0x01
+#define RECORD_FAILED    0x02
+#define RECORD_RECONNECT 0x04
+
+// Records looked through for a read that matches
+#define REPLAY_LOOKAHEAD 256
+// Reads in a row that match nothing before the replay gives up
+#define REPLAY_MAX_MISSES 1000
+
+// Passes transfers through to another probe and logs them
+class RecordingProbe : public Probe
+{
+public:
+    RecordingProbe(Probe &probe);
+    ~RecordingProbe();
+
+    bool open(const std::string &filename);
+    void close();
+
+    virtual bool read(uint8_t *ptr, size_t address, size_t size);
+    virtual bool write(uint8_t *ptr, size_t address, size_t size);
+
+    virtual void getRAM(size_t &base, size_t &size);
+    virtual void getFlash(size_t &base, size_t &size);
+
+    virtual bool canReconnect() const { return probe.canReconnect(); }
+    virtual bool reconnect();
+
+    // The costs as saved in the file so a replay decides the same way
+    virtual double getFixedCost() const { return fixedCost; }
+    virtual double getByteCost() const { return byteCost; }
+
+protected:
+    typedef std::chrono::steady_clock Clock;
+
+    Probe &probe;
+    FILE *fp;
+    uint32_t fixedCostNs;
+    uint32_t byteCostPs;
+    double fixedCost;
+    double byteCost;
+    Clock::time_point last;
+
+    void record(uint8_t type, const uint8_t *ptr, size_t address, size_t size);
+    void putVarint(uint64_t v);
+};
+
+// Plays back a recording. Each read returns the data of the next recorded
+// read of the same address and size, skipping anything in between so that
+// a replay which does fewer writes than the original (no keyboard input for
+// example) stays in step. Only the next REPLAY_LOOKAHEAD records are looked
+// at. A read that is not among them fails and is counted without moving
+// through the recording, so the reads after it can still match. Writes are
+// accepted and discarded. Once the recording is exhausted, or nothing has
+// matched for REPLAY_MAX_MISSES reads, every read fails.
+//
+// By default transfers complete immediately so the decoding and output can
+// be benchmarked. In real time mode reads wait until the same time after
+// the start as in the recording.
+class ReplayProbe : public Probe
+{
+public:
+    ReplayProbe();
+
+    bool open(const std::string &filename);
+
+    void setRealTime(bool b) { realTime = b; }
+
+    virtual bool read(uint8_t *ptr, size_t address, size_t size);
+    virtual bool write(uint8_t *ptr, size_t address, size_t size);
+
+    virtual void getRAM(size_t &base, size_t &size);
+    virtual void getFlash(size_t &base, size_t &size);
+
+    virtual double getFixedCost() const { return fixedCost; }
+    virtual double getByteCost() const { return byteCost; }
+
+    bool atEnd() const { return pos >= data.size(); }
+    size_t getTransfers() const { return transfers; }
+    size_t getSkipped() const { return skipped; }
+    size_t getMismatches() const { return mismatches; }
+
+protected:
+    typedef std::chrono::steady_clock Clock;
+
+    struct Record
+    {
+        uint8_t type;
+        uint64_t time;
+        size_t address;
+        size_t size;
+        const uint8_t *data;
+    };
+
+    std::vector<uint8_t> data;
+    size_t pos;
+    uint64_t time;
+    uint32_t ram[2];
+    uint32_t flash[2];
+    double fixedCost;
+    double byteCost;
+
+    bool realTime;
+    bool started;
+    Clock::time_point start;
+
+    size_t transfers;
+    size_t skipped;
+    size_t mismatches;
+    // Reads since the last one that matched
+    unsigned int misses;
+
+    bool getVarint(size_t &p, uint64_t &v) const;
+    bool parse(size_t &p, Record &r, uint64_t t) const;
+};
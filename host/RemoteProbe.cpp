@@ -0,0 +1,395 @@
+#include "RemoteProbe.h"
+#include "Channel.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <algorithm>
+
+RemoteProbe::RemoteProbe()
+    : fd(-1),
+      nextId(1),
+      timeout(5.0),
+      ramBase(0),
+      ramSize(0),
+      flashBase(0),
+      flashSize(0),
+      fixedCost(1e-3),
+      byteCost(1e-6),
+      inPos(0)
+{
+}
+
+RemoteProbe::~RemoteProbe()
+{
+    close();
+}
+
+bool RemoteProbe::open(const std::string &path)
+{
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path))
+    {
+        fprintf(stderr, "Socket path too long: %s\n", path.c_str());
+        return false;
+    }
+    strcpy(addr.sun_path, path.c_str());
+
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+    {
+        perror("socket");
+        return false;
+    }
+
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0)
+    {
+        perror(path.c_str());
+        close();
+        return false;
+    }
+
+    uint32_t info[6];
+    ProbeMessage h;
+    uint32_t id = queue(PROBE_MSG_INFO, 0, 0);
+    if (!flush() || !waitResponse(id, h, (uint8_t *)info, sizeof(info)) ||
+        h.status != PROBE_STATUS_OK || h.size != sizeof(info))
+    {
+        fprintf(stderr, "No response from the probe server\n");
+        close();
+        return false;
+    }
+
+    ramBase = info[0];
+    ramSize = info[1];
+    flashBase = info[2];
+    flashSize = info[3];
+    fixedCost = info[4] * 1e-9;
+    byteCost = info[5] * 1e-12;
+
+    return true;
+}
+
+void RemoteProbe::close()
+{
+    if (fd >= 0)
+    {
+        ::close(fd);
+        fd = -1;
+    }
+}
+
+bool RemoteProbe::read(uint8_t *ptr, size_t address, size_t size)
+{
+    ProbeRegion r;
+    r.ptr = ptr;
+    r.address = address;
+    r.size = size;
+    return readv(&r, 1);
+}
+
+bool RemoteProbe::write(uint8_t *ptr, size_t address, size_t size)
+{
+    ProbeMessage h;
+    uint32_t id = queue(PROBE_MSG_WRITE, address, size, ptr, size);
+    return flush() && waitResponse(id, h, nullptr, 0) &&
+        h.status == PROBE_STATUS_OK;
+}
+
+bool RemoteProbe::readv(const ProbeRegion *regions, size_t count)
+{
+    // Send them all before waiting so the server sees them together
+    uint32_t first = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        if (regions[i].size > PROBE_MAX_TRANSFER)
+        {
+            // Split up large reads
+            for (size_t pos = 0; pos < regions[i].size;
+                 pos += PROBE_MAX_TRANSFER)
+            {
+                size_t n = std::min(regions[i].size - pos,
+                                    (size_t)PROBE_MAX_TRANSFER);
+                uint32_t id = queue(PROBE_MSG_READ, regions[i].address + pos,
+                                    n);
+                if (i == 0 && pos == 0)
+                    first = id;
+            }
+        }
+        else
+        {
+            uint32_t id = queue(PROBE_MSG_READ, regions[i].address,
+                                regions[i].size);
+            if (i == 0)
+                first = id;
+        }
+    }
+
+    if (!flush())
+        return false;
+
+    // Responses come back in order
+    bool ok = true;
+    uint32_t id = first;
+    for (size_t i = 0; i < count; i++)
+    {
+        for (size_t pos = 0; pos < regions[i].size || pos == 0;
+             pos += PROBE_MAX_TRANSFER)
+        {
+            size_t n = std::min(regions[i].size - pos,
+                                (size_t)PROBE_MAX_TRANSFER);
+            ProbeMessage h;
+            if (!waitResponse(id++, h, regions[i].ptr + pos, n))
+                return false;
+
+            if (h.status != PROBE_STATUS_OK || h.size != n)
+                ok = false;
+
+            if (regions[i].size == 0)
+                break;
+        }
+    }
+
+    readvRegions += count;
+    readvTransfers++;
+
+    return ok;
+}
+
+int RemoteProbe::pollChannels(Channel *const *channels, size_t count)
+{
+    bool active = false;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        Channel &c = *channels[i];
+        if (std::find(subscribed.begin(), subscribed.end(),
+                      c.getAddress()) == subscribed.end())
+        {
+            ProbeMessage h;
+            uint32_t id = queue(PROBE_MSG_SUBSCRIBE, c.getAddress(), 0);
+            if (!flush() || !waitResponse(id, h, nullptr, 0))
+                return -1;
+
+            if (h.status != PROBE_STATUS_OK)
+            {
+                fprintf(stderr, "No control block at 0x%zx\n",
+                        c.getAddress());
+                return -1;
+            }
+
+            subscribed.push_back(c.getAddress());
+        }
+
+        // The server queues the input until there is space in the target
+        if (c.hasInput())
+        {
+            uint8_t buf[Channel::BUFFER_SIZE];
+            size_t n = c.takeInput(buf, sizeof(buf));
+            if (n > 0)
+            {
+                queue(PROBE_MSG_INPUT, c.getAddress(), n, buf, n);
+                active = true;
+            }
+        }
+    }
+
+    if (!flush() || !receive(false))
+        return -1;
+
+    // Everything that arrived since the last poll
+    ProbeMessage h;
+    const uint8_t *data;
+    while (nextMessage(h, data))
+        keepOutput(h, data);
+
+    for (const Output &o : outputs)
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            if (channels[i]->getAddress() != o.address)
+                continue;
+
+            if (o.reset)
+                channels[i]->reset();
+            else
+                channels[i]->receive(o.data.data(), o.data.size());
+        }
+        active = true;
+    }
+    outputs.clear();
+
+    return active;
+}
+
+void RemoteProbe::getRAM(size_t &base, size_t &size)
+{
+    base = ramBase;
+    size = ramSize;
+}
+
+void RemoteProbe::getFlash(size_t &base, size_t &size)
+{
+    base = flashBase;
+    size = flashSize;
+}
+
+// Add a request to the output buffer and return its id
+uint32_t RemoteProbe::queue(uint8_t type, size_t address, size_t size,
+                            const uint8_t *data, size_t data_size)
+{
+    ProbeMessage h;
+    memset(&h, 0, sizeof(h));
+    h.type = type;
+    h.id = nextId++;
+    h.address = address;
+    h.size = size;
+
+    const uint8_t *p = (const uint8_t *)&h;
+    out.insert(out.end(), p, p + sizeof(h));
+    if (data_size > 0)
+        out.insert(out.end(), data, data + data_size);
+
+    return h.id;
+}
+
+bool RemoteProbe::flush()
+{
+    size_t pos = 0;
+    while (pos < out.size())
+    {
+        ssize_t n = send(fd, out.data() + pos, out.size() - pos,
+                         MSG_NOSIGNAL);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+
+            perror("Probe server");
+            return false;
+        }
+
+        pos += n;
+    }
+
+    out.clear();
+    return true;
+}
+
+// Read what the server has sent. If wait is true block until something
+// arrives or the timeout
+bool RemoteProbe::receive(bool wait)
+{
+    if (fd < 0)
+        return false;
+
+    if (wait)
+    {
+        struct pollfd p;
+        p.fd = fd;
+        p.events = POLLIN;
+        int res = poll(&p, 1, timeout * 1000);
+        if (res < 0 && errno == EINTR)
+            return true;
+        if (res <= 0)
+        {
+            fprintf(stderr, "Timed out waiting for the probe server\n");
+            return false;
+        }
+    }
+
+    // Drop what has already been parsed
+    if (inPos > 0)
+    {
+        in.erase(in.begin(), in.begin() + inPos);
+        inPos = 0;
+    }
+
+    uint8_t buf[65536];
+    ssize_t n = recv(fd, buf, sizeof(buf), MSG_DONTWAIT);
+    if (n == 0)
+    {
+        fprintf(stderr, "Probe server closed the connection\n");
+        close();
+        return false;
+    }
+    if (n < 0)
+    {
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+            return true;
+
+        perror("Probe server");
+        return false;
+    }
+
+    in.insert(in.end(), buf, buf + n);
+    return true;
+}
+
+// Get the next complete message that has been received. Data points into
+// the receive buffer and is valid until the next receive()
+bool RemoteProbe::nextMessage(ProbeMessage &h, const uint8_t *&data)
+{
+    if (in.size() - inPos < sizeof(h))
+        return false;
+
+    memcpy(&h, &in[inPos], sizeof(h));
+    if (in.size() - inPos - sizeof(h) < h.size)
+        return false;
+
+    data = &in[inPos + sizeof(h)];
+    inPos += sizeof(h) + h.size;
+    return true;
+}
+
+// Keep output and resets of the subscribed control blocks for
+// pollChannels(). Returns false for any other message
+bool RemoteProbe::keepOutput(const ProbeMessage &h, const uint8_t *data)
+{
+    if (h.type != PROBE_MSG_OUTPUT && h.type != PROBE_MSG_RESET)
+        return false;
+
+    Output o;
+    o.address = h.address;
+    o.reset = h.type == PROBE_MSG_RESET;
+    o.data.assign(data, data + h.size);
+    outputs.push_back(std::move(o));
+    return true;
+}
+
+// Wait for the response with this id copying up to size bytes of its data
+// to ptr. Output that arrives first is kept for pollChannels()
+bool RemoteProbe::waitResponse(uint32_t id, ProbeMessage &h, uint8_t *ptr,
+                               size_t size)
+{
+    for (;;)
+    {
+        const uint8_t *data;
+        while (nextMessage(h, data))
+        {
+            if (keepOutput(h, data))
+                continue;
+
+            if (h.id != id)
+            {
+                fprintf(stderr, "Unexpected response from the probe "
+                        "server\n");
+                return false;
+            }
+
+            if (ptr != nullptr)
+                memcpy(ptr, data, std::min(size, (size_t)h.size));
+            return true;
+        }
+
+        if (!receive(true))
+            return false;
+    }
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include "Probe.h"
+#include "ProbeServer.h"
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <string>
+#include <vector>
+
+// A probe shared through a ProbeServer. Reads and writes are sent to the
+// server and the regions of a readv() are all sent before waiting for the
+// responses so the server can make them in one transfer. Channels are
+// drained by the server and their output passed on by pollChannels().
+class RemoteProbe : public Probe
+{
+public:
+    RemoteProbe();
+    ~RemoteProbe();
+
+    bool open(const std::string &path = PROBE_SERVER_SOCKET);
+    void close();
+
+    // Seconds to wait for a response before giving up
+    void setTimeout(double t) { timeout = t; }
+
+    virtual bool read(uint8_t *ptr, size_t address, size_t size);
+    virtual bool write(uint8_t *ptr, size_t address, size_t size);
+    virtual bool readv(const ProbeRegion *regions, size_t count);
+    using Probe::readv;
+
+    virtual int pollChannels(Channel *const *channels, size_t count);
+
+    virtual void getRAM(size_t &base, size_t &size);
+    virtual void getFlash(size_t &base, size_t &size);
+
+    virtual double getFixedCost() const { return fixedCost; }
+    virtual double getByteCost() const { return byteCost; }
+
+protected:
+    // Output or a reset received while waiting for a response
+    struct Output
+    {
+        size_t address;
+        bool reset;
+        std::vector<uint8_t> data;
+    };
+
+    int fd;
+    uint32_t nextId;
+    double timeout;
+    size_t ramBase;
+    size_t ramSize;
+    size_t flashBase;
+    size_t flashSize;
+    double fixedCost;
+    double byteCost;
+
+    std::vector<uint8_t> in;
+    size_t inPos;
+    std::vector<uint8_t> out;
+    std::vector<Output> outputs;
+    std::vector<size_t> subscribed;
+
+    uint32_t queue(uint8_t type, size_t address, size_t size,
+                   const uint8_t *data = nullptr, size_t data_size = 0);
+    bool flush();
+    bool receive(bool wait);
+    bool waitResponse(uint32_t id, ProbeMessage &h, uint8_t *data,
+                      size_t size);
+    bool nextMessage(ProbeMessage &h, const uint8_t *&data);
+    bool keepOutput(const ProbeMessage &h, const uint8_t *data);
+};
@@ -1,5 +1,7 @@
 #include "STLink.h"
 #include <assert.h>
+#include <ctype.h>
+#include <stdio.h>
 #include <string.h>
 #include <iostream>
 
@@ -13,7 +15,11 @@ extern "C"
 
 
 STLink::STLink()
-    : handle(nullptr)
+    : handle(nullptr),
+      clock(24000),
+      maxBlock(0x1000),
+      fixedCost(Probe::getFixedCost()),
+      byteCost(Probe::getByteCost())
 {
     const char *chip_dir = MAKE_STR(STLINK_CHIPS_DIR);
     char buf[256];
@@ -26,35 +32,125 @@ STLink::~STLink()
     close();
 }
 
-bool STLink::open()
+bool STLink::open(const std::string &serial)
 {
-    enum ugly_loglevel loglevel = UERROR;
+    if (!connect(serial, true))
+        return false;
+
+    std::cout << "Chip Id " << handle->chip_id << "\n";
+    serialNumber = getSerial();
+
+    return true;
+}
+
+bool STLink::reconnect()
+{
+    close();
+
+    // Quietly as this is tried over and over until the probe is back
+    return connect(serialNumber, false);
+}
+
+bool STLink::connect(const std::string &serial, bool verbose)
+{
+    enum ugly_loglevel loglevel = verbose ? UERROR : UFATAL;
     enum connect_type  ct = CONNECT_HOT_PLUG;
-    char *serial_number = 0;
+    char serial_number[STLINK_SERIAL_BUFFER_SIZE] = {};
+    strncpy(serial_number, serial.c_str(), sizeof(serial_number) - 1);
     
-    handle = stlink_open_usb(loglevel, ct, serial_number,
+    handle = stlink_open_usb(loglevel, ct,
+                             serial.empty() ? nullptr : serial_number,
                              STLINK_SWDCLK_4MHZ_DIVISOR);
 
     if (handle == nullptr)
     {
-        std::cerr << "Failed to open the debugger\n";
+        if (verbose)
+        {
+            std::cerr << "Failed to open the debugger";
+            if (!serial.empty())
+                std::cerr << " " << serial;
+            std::cerr << "\n";
+        }
         return false;
     }
     
-    stlink_set_swdclk(handle, 24000); // Run STLINK/V3 @ 24MHz
+    // 24MHz suits an STLINK/V3. Calibration may pick another rate
+    setClock(clock);
 
 
     if (stlink_load_device_params(handle) != 0)
     {
-        std::cerr << "Failed to load device parameters\n";
+        if (verbose)
+            std::cerr << "Failed to load device parameters\n";
+        close();
         return false;
     }
 
-    std::cout << "Chip Id " << handle->chip_id << "\n";
+    return true;
+}
+
+static std::string formatSerial(const char *raw, size_t size)
+{
+    std::string serial;
+    for (size_t i = 0; i < size && raw[i]; i++)
+    {
+        // Older libraries give the raw bytes rather than a hex string
+        char c = raw[i];
+        if (isalnum((unsigned char)c))
+            serial += c;
+        else
+        {
+            char buf[4];
+            snprintf(buf, sizeof(buf), "%02X", (uint8_t)c);
+            serial += buf;
+        }
+    }
+
+    return serial;
+}
+
+std::string STLink::getSerial() const
+{
+    return formatSerial(handle->serial, sizeof(handle->serial));
+}
+
+std::vector<std::string> STLink::list()
+{
+    std::vector<std::string> serials;
+
+    stlink_t **devs = nullptr;
+    size_t n = stlink_probe_usb(&devs, CONNECT_HOT_PLUG,
+                                STLINK_SWDCLK_4MHZ_DIVISOR);
+    for (size_t i = 0; i < n; i++)
+        serials.push_back(formatSerial(devs[i]->serial,
+                                       sizeof(devs[i]->serial)));
+
+    stlink_probe_usb_free(&devs, n);
+
+    return serials;
+}
+
+bool STLink::setClock(int khz)
+{
+    clock = khz;
+    if (handle == nullptr)
+        return true;
+
+    if (stlink_set_swdclk(handle, khz))
+    {
+        std::cerr << "Failed to set the SWD clock to " << khz << "kHz\n";
+        return false;
+    }
 
     return true;
 }
 
+void STLink::setCosts(double fixed, double perByte)
+{
+    fixedCost = fixed;
+    byteCost = perByte;
+}
+
 void STLink::close()
 {
     if (handle != nullptr)
@@ -66,8 +162,12 @@ void STLink::close()
 
 bool STLink::read(uint8_t *ptr, size_t address, size_t size)
 {
-    // Seems to lockup if trying to read larger than 0x1000
-    size_t block_size = 0x1000;
+    // Closed by a reconnect that has not worked yet
+    if (handle == nullptr)
+        return false;
+
+    // Some probes lockup on large reads so the size is found by calibration
+    size_t block_size = maxBlock;
     
     while (size != 0)
     {
@@ -102,16 +202,15 @@ bool STLink::read(uint8_t *ptr, size_t address, size_t size)
 
 bool STLink::write(uint8_t *ptr, size_t address, size_t size)
 {
-    size_t block_size = 0x1000;
+    if (handle == nullptr)
+        return false;
 
     // Does not like doing reads or writes of zero size
     while (size != 0)
     {
+        size_t block_size = maxBlock;
         if (size < block_size)
             block_size = size;
-        
-        assert(size <= Q_BUF_LEN);
-        memcpy(handle->q_buf, ptr, size);
 
         uint8_t unaligned_address_offset = address % 4;
         if (unaligned_address_offset % 4 != 0 || block_size < 4)
@@ -119,14 +218,15 @@ bool STLink::write(uint8_t *ptr, size_t address, size_t size)
             // Do 8 bit writes at the start to align the address on a word
             // boundary. Also do 8 bit writes are the end to finish off
             // the buffer.
-            
+
             // Write 1 to 3 bytes to align on the address boundary
             if (unaligned_address_offset + block_size > 4)
                 block_size = 4 - unaligned_address_offset;
 
+            memcpy(handle->q_buf, ptr, block_size);
             if (stlink_write_mem8(handle, address, block_size) )
             {
-                
+
                 perror("Failed to write to device\n");
                 return false;
             }
@@ -135,29 +235,90 @@ bool STLink::write(uint8_t *ptr, size_t address, size_t size)
         {
             // Address is word aligned so just need to align the size
             block_size -= (block_size % 4);
-            
-            if (stlink_write_mem32(handle, address, size) )
+
+            memcpy(handle->q_buf, ptr, block_size);
+            if (stlink_write_mem32(handle, address, block_size) )
             {
-                perror("Failed to read from device\n");
+                perror("Failed to write to device\n");
                 return false;
             }
         }
 
         address += block_size;
         size -= block_size;
+        ptr += block_size;
+    }
+
+    return true;
+}
+
+bool STLink::halt()
+{
+    // Closed by a reconnect that has not worked yet
+    if (handle == nullptr)
+        return false;
+
+    if (stlink_force_debug(handle))
+    {
+        std::cerr << "Failed to halt the core\n";
+        return false;
+    }
+
+    return true;
+}
+
+bool STLink::resume()
+{
+    if (handle == nullptr)
+        return false;
+
+    if (stlink_run(handle, RUN_NORMAL))
+    {
+        std::cerr << "Failed to restart the core\n";
+        return false;
     }
 
     return true;
 }
 
+bool STLink::readRegisters(uint32_t *regs)
+{
+    if (handle == nullptr)
+        return false;
+
+    struct stlink_reg reg;
+    if (stlink_read_all_regs(handle, &reg))
+    {
+        std::cerr << "Failed to read the registers\n";
+        return false;
+    }
+
+    memcpy(regs, reg.r, 16 * sizeof(uint32_t));
+    regs[16] = reg.xpsr;
+
+    return true;
+}
+
 void STLink::getRAM(size_t &base, size_t &size)
 {
+    if (handle == nullptr)
+    {
+        base = size = 0;
+        return;
+    }
+
     base = handle->sram_base;
     size = handle->sram_size;
 }
 
 void STLink::getFlash(size_t &base, size_t &size)
 {
+    if (handle == nullptr)
+    {
+        base = size = 0;
+        return;
+    }
+
     base = handle->flash_base;
     size = handle->flash_size;
 }
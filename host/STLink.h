@@ -1,26 +1,70 @@
 #pragma once
 
+#include "Probe.h"
+
 #include <stlink.h>
 
-class STLink
+#include <string>
+#include <vector>
+
+class STLink : public Probe
 {
 public:
     STLink();
     ~STLink();
 
-    bool open();
+    // Open the probe with this serial number or the first one found
+    bool open(const std::string &serial = std::string());
     void close();
 
+    // Open the probe used before again. The clock and costs are kept
+    virtual bool canReconnect() const { return !serialNumber.empty(); }
+    virtual bool reconnect();
+
+    std::string getSerial() const;
+
+    // Serial numbers of all the connected probes
+    static std::vector<std::string> list();
+
+    // SWD clock in kHz
+    bool setClock(int khz);
+    int getClock() const { return clock; }
+
+    // Largest single transfer
+    void setMaxBlock(size_t size) { maxBlock = size; }
+    size_t getMaxBlock() const { return maxBlock; }
+
+    // Measured costs. See Calibration
+    void setCosts(double fixed, double perByte);
+    virtual double getFixedCost() const { return fixedCost; }
+    virtual double getByteCost() const { return byteCost; }
+
     // Read and write method handle switching between the 8 bit and 32 bit
     // variants depending on address alignment. For large transfers efficient
     // 32 bit transfers will be used for the aligned sections of the data
-    bool read(uint8_t *ptr, size_t address, size_t size);
-    bool write(uint8_t *ptr, size_t address, size_t size);
+    virtual bool read(uint8_t *ptr, size_t address, size_t size);
+    virtual bool write(uint8_t *ptr, size_t address, size_t size);
+
+    virtual void getRAM(size_t &base, size_t &size);
+    virtual void getFlash(size_t &base, size_t &size);
 
-    void getRAM(size_t &base, size_t &size);
-    void getFlash(size_t &base, size_t &size);
+    // Stop the core so memory is consistent and registers can be read
+    bool halt();
+    bool resume();
+
+    // Read r0 to r15 and xPSR into regs[0] to regs[16]. The core must be
+    // halted
+    bool readRegisters(uint32_t *regs);
     
 protected:
     stlink_t *handle;
+    // Serial number of the probe opened
+    std::string serialNumber;
+    int clock;
+    size_t maxBlock;
+    double fixedCost;
+    double byteCost;
+
+    bool connect(const std::string &serial, bool verbose);
 };
 
@@ -0,0 +1,85 @@
+#include "Snapshot.h"
+
+#include <stdio.h>
+#include <string.h>
+
+static uint32_t getWord(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+Snapshot::Snapshot(Probe &probe_, const Location &location)
+    : probe(probe_),
+      address(location.address),
+      id(location.id),
+      size(location.size),
+      maxRetries(10),
+      reads(0),
+      retries(0),
+      failures(0)
+{
+    // Header, data padded to a word and the trailing sequence check
+    blockSize = DATA_OFFSET + ((size + 3) & ~3) + 4;
+    block.resize(blockSize);
+}
+
+std::vector<Snapshot::Location> Snapshot::find(Probe &probe)
+{
+    std::vector<Location> res;
+
+    size_t ram_base, ram_size;
+    probe.getRAM(ram_base, ram_size);
+
+    std::vector<uint8_t> ram;
+    ram.resize(ram_size);
+
+    if (!probe.read(ram.data(), ram_base, ram_size))
+    {
+        fprintf(stderr, "Could not read ram\n");
+        return res;
+    }
+
+    for (size_t i = 0; i + DATA_OFFSET <= ram_size; i += 4)
+    {
+        if (getWord(&ram[i]) != SWDSNAPSHOT_MAGIC)
+            continue;
+
+        Location l;
+        l.address = ram_base + i;
+        l.id = ram[i + ID_OFFSET] | (ram[i + ID_OFFSET + 1] << 8);
+        l.size = ram[i + SIZE_OFFSET] | (ram[i + SIZE_OFFSET + 1] << 8);
+
+        // The whole block must be in RAM
+        if (i + DATA_OFFSET + ((l.size + 3) & ~3) + 4 > ram_size)
+            continue;
+
+        res.push_back(l);
+    }
+
+    return res;
+}
+
+int Snapshot::read(std::vector<uint8_t> &value, uint32_t &sequence)
+{
+    for (unsigned int i = 0; i <= maxRetries; i++)
+    {
+        if (!probe.read(block.data(), address, blockSize))
+            return -1;
+
+        // The probe reads in increasing address order so if the trailer
+        // still matches the header nothing was published in between
+        sequence = getWord(&block[SEQUENCE_OFFSET]);
+        if (sequence == getWord(&block[blockSize - 4]))
+        {
+            value.assign(block.begin() + DATA_OFFSET,
+                         block.begin() + DATA_OFFSET + size);
+            reads++;
+            return 1;
+        }
+
+        retries++;
+    }
+
+    failures++;
+    return 0;
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include "Probe.h"
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <vector>
+
+#define SWDSNAPSHOT_MAGIC 0xd5715e0e
+
+// Host side of an SWDSnapshot in target RAM. See src/SWDSnapshot.h for the
+// layout. Each read gets the whole block in one transfer and is repeated
+// if the target was part way through publishing.
+class Snapshot
+{
+public:
+    static const size_t ID_OFFSET = 4;
+    static const size_t SIZE_OFFSET = 6;
+    static const size_t SEQUENCE_OFFSET = 8;
+    static const size_t DATA_OFFSET = 12;
+
+    struct Location
+    {
+        size_t address;
+        uint16_t id;
+        uint16_t size;
+    };
+
+    Snapshot(Probe &probe, const Location &location);
+
+    // Search target RAM for snapshot blocks
+    static std::vector<Location> find(Probe &probe);
+
+    uint16_t getId() const { return id; }
+    size_t getSize() const { return size; }
+
+    // Give up after this many torn reads in a row
+    void setMaxRetries(unsigned int n) { maxRetries = n; }
+
+    // Copy the data into value which is resized to getSize(). Returns 1 on
+    // success, 0 if every try was torn or -1 on a probe error
+    int read(std::vector<uint8_t> &value, uint32_t &sequence);
+
+    unsigned long getReads() const { return reads; }
+    unsigned long getRetries() const { return retries; }
+    unsigned long getFailures() const { return failures; }
+
+protected:
+    Probe &probe;
+    size_t address;
+    uint16_t id;
+    size_t size;
+    size_t blockSize;
+    unsigned int maxRetries;
+    std::vector<uint8_t> block;
+
+    unsigned long reads;
+    unsigned long retries;
+    unsigned long failures;
+};
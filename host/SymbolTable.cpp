@@ -0,0 +1,145 @@
+#include "SymbolTable.h"
+
+#include <cxxabi.h>
+#include <elf.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+
+static std::string demangle(const char *name)
+{
+    int status;
+    char *res = abi::__cxa_demangle(name, nullptr, nullptr, &status);
+    if (res == nullptr)
+        return name;
+
+    std::string s = res;
+    free(res);
+    return s;
+}
+
+bool SymbolTable::load(const std::string &filename)
+{
+    FILE *fp = fopen(filename.c_str(), "rb");
+    if (fp == nullptr)
+    {
+        perror(filename.c_str());
+        return false;
+    }
+
+    std::vector<uint8_t> file;
+    uint8_t buf[65536];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), fp)) > 0)
+        file.insert(file.end(), buf, buf + n);
+    fclose(fp);
+
+    Elf32_Ehdr ehdr;
+    if (file.size() < sizeof(ehdr))
+    {
+        fprintf(stderr, "%s: Not an ELF file\n", filename.c_str());
+        return false;
+    }
+
+    memcpy(&ehdr, file.data(), sizeof(ehdr));
+    if (memcmp(ehdr.e_ident, ELFMAG, SELFMAG) != 0 ||
+        ehdr.e_ident[EI_CLASS] != ELFCLASS32 ||
+        ehdr.e_ident[EI_DATA] != ELFDATA2LSB ||
+        ehdr.e_shentsize != sizeof(Elf32_Shdr) ||
+        ehdr.e_shoff + (size_t)ehdr.e_shnum * sizeof(Elf32_Shdr) >
+        file.size())
+    {
+        fprintf(stderr, "%s: Not a 32 bit little endian ELF file\n",
+                filename.c_str());
+        return false;
+    }
+
+    std::vector<Elf32_Shdr> sections(ehdr.e_shnum);
+    memcpy(sections.data(), file.data() + ehdr.e_shoff,
+           ehdr.e_shnum * sizeof(Elf32_Shdr));
+
+    symbols.clear();
+    for (const Elf32_Shdr &s : sections)
+    {
+        if (s.sh_type != SHT_SYMTAB || s.sh_link >= sections.size())
+            continue;
+
+        const Elf32_Shdr &strtab = sections[s.sh_link];
+        if (s.sh_offset + s.sh_size > file.size() ||
+            strtab.sh_offset + strtab.sh_size > file.size())
+            continue;
+
+        const char *strings = (const char *)file.data() + strtab.sh_offset;
+        for (size_t off = 0; off + sizeof(Elf32_Sym) <= s.sh_size;
+             off += sizeof(Elf32_Sym))
+        {
+            Elf32_Sym sym;
+            memcpy(&sym, file.data() + s.sh_offset + off, sizeof(sym));
+            if (ELF32_ST_TYPE(sym.st_info) != STT_FUNC ||
+                sym.st_shndx == SHN_UNDEF || sym.st_name >= strtab.sh_size)
+                continue;
+
+            Symbol f;
+            // Bit 0 marks Thumb code
+            f.address = sym.st_value & ~1u;
+            f.size = sym.st_size;
+            f.name = demangle(strings + sym.st_name);
+            symbols.push_back(f);
+        }
+    }
+
+    if (symbols.empty())
+    {
+        fprintf(stderr, "%s: No function symbols\n", filename.c_str());
+        return false;
+    }
+
+    // Where several names share an address keep the one with a size
+    std::sort(symbols.begin(), symbols.end(),
+              [](const Symbol &a, const Symbol &b) {
+                  if (a.address != b.address)
+                      return a.address < b.address;
+                  return a.size > b.size;
+              });
+    symbols.erase(std::unique(symbols.begin(), symbols.end(),
+                              [](const Symbol &a, const Symbol &b) {
+                                  return a.address == b.address;
+                              }),
+                  symbols.end());
+
+    // Hand written assembler often has no size so runs to the next symbol
+    for (size_t i = 0; i + 1 < symbols.size(); i++)
+        if (symbols[i].size == 0)
+            symbols[i].size = symbols[i + 1].address - symbols[i].address;
+
+    return true;
+}
+
+const SymbolTable::Symbol *SymbolTable::lookup(uint32_t address) const
+{
+    auto it = std::upper_bound(symbols.begin(), symbols.end(), address,
+                               [](uint32_t a, const Symbol &s) {
+                                   return a < s.address;
+                               });
+    if (it == symbols.begin())
+        return nullptr;
+
+    --it;
+    if (address - it->address >= it->size)
+        return nullptr;
+
+    return &*it;
+}
+
+std::string SymbolTable::name(uint32_t address) const
+{
+    const Symbol *s = lookup(address);
+    if (s != nullptr)
+        return s->name;
+
+    char buf[16];
+    snprintf(buf, sizeof(buf), "0x%08x", address);
+    return buf;
+}
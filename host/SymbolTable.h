@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <string>
+#include <vector>
+
+// Function symbols from a 32 bit firmware ELF file sorted by address for
+// looking up program counter values
+class SymbolTable
+{
+public:
+    struct Symbol
+    {
+        uint32_t address;
+        uint32_t size;
+        std::string name;
+    };
+
+    bool load(const std::string &filename);
+
+    // The function containing address or nullptr if there is none
+    const Symbol *lookup(uint32_t address) const;
+
+    // Function name or the address in hex if it is not in a function
+    std::string name(uint32_t address) const;
+
+    size_t size() const { return symbols.size(); }
+
+protected:
+    std::vector<Symbol> symbols;
+};
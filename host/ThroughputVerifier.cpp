@@ -0,0 +1,197 @@
+#include "ThroughputVerifier.h"
+#include "CommandClient.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// "#ssssssss rrrrrrrr " before the payload and " cccc" after it
+#define RECORD_HEADER 19
+#define RECORD_TRAILER 5
+
+static bool parseHex(const char *p, int digits, uint32_t &v)
+{
+    v = 0;
+    for (int i = 0; i < digits; i++)
+    {
+        char c = p[i];
+        if (c >= '0' && c <= '9')
+            v = (v << 4) | (c - '0');
+        else if (c >= 'A' && c <= 'F')
+            v = (v << 4) | (c - 'A' + 10);
+        else
+            return false;
+    }
+
+    return true;
+}
+
+ThroughputVerifier::ThroughputVerifier()
+    : started(false),
+      lastSequence(0),
+      lastRate(0),
+      restarts(0),
+      total(),
+      interval(),
+      lossSeen(false),
+      lossTime(0),
+      lossSequence(0),
+      lossRate(0)
+{
+}
+
+void ThroughputVerifier::receive(const uint8_t *data, size_t size)
+{
+    total.bytes += size;
+    interval.bytes += size;
+
+    for (size_t i = 0; i < size; i++)
+    {
+        char c = data[i];
+        if (c == '\n')
+        {
+            processLine(line);
+            line.clear();
+        }
+        else if (c != '\r')
+            line += c;
+    }
+}
+
+void ThroughputVerifier::processLine(const std::string &l)
+{
+    // Anything ahead of the last '#' is the end of a record whose start
+    // was overwritten
+    size_t hash = l.rfind('#');
+    if (hash != 0)
+    {
+        if (started && !l.empty())
+        {
+            total.truncated++;
+            interval.truncated++;
+        }
+
+        if (hash == std::string::npos)
+            return;
+    }
+
+    const char *r = l.c_str() + hash;
+    size_t len = l.size() - hash;
+
+    uint32_t seq, rate, crc;
+    if (len < RECORD_HEADER + RECORD_TRAILER ||
+        r[9] != ' ' || r[18] != ' ' || r[len - RECORD_TRAILER] != ' ' ||
+        !parseHex(r + 1, 8, seq) || !parseHex(r + 10, 8, rate) ||
+        !parseHex(r + len - 4, 4, crc))
+    {
+        if (started)
+        {
+            total.corrupt++;
+            interval.corrupt++;
+        }
+        return;
+    }
+
+    if (CommandClient::crc16(r, len - RECORD_TRAILER) != crc)
+    {
+        total.corrupt++;
+        interval.corrupt++;
+        return;
+    }
+
+    Clock::time_point now = Clock::now();
+    if (!started)
+    {
+        started = true;
+        startTime = now;
+        intervalStart = now;
+    }
+    else if (seq == 0 && lastSequence != 0)
+    {
+        // The target was reset
+        restarts++;
+    }
+    else if (seq <= lastSequence)
+    {
+        total.duplicates++;
+        interval.duplicates++;
+        return;
+    }
+    else if (seq != lastSequence + 1)
+        countLoss(seq - lastSequence - 1);
+
+    lastSequence = seq;
+    lastRate = rate;
+    lastTime = now;
+
+    total.records++;
+    interval.records++;
+}
+
+void ThroughputVerifier::countLoss(uint64_t n)
+{
+    if (!lossSeen)
+    {
+        lossSeen = true;
+        lossTime = std::chrono::duration<double>(Clock::now() -
+                                                 startTime).count();
+        lossSequence = lastSequence + 1;
+        lossRate = lastRate;
+    }
+
+    total.lost += n;
+    interval.lost += n;
+}
+
+void ThroughputVerifier::update(FILE *fp)
+{
+    if (!started)
+        return;
+
+    Clock::time_point now = Clock::now();
+    double seconds = std::chrono::duration<double>(now -
+                                                   intervalStart).count();
+    if (seconds < 1.0)
+        return;
+
+    fprintf(fp, "%8.1fs rate %6u/s %9.0f bytes/s %7.0f records/s "
+            "lost %llu dup %llu corrupt %llu truncated %llu\n",
+            std::chrono::duration<double>(now - startTime).count(),
+            lastRate, interval.bytes / seconds, interval.records / seconds,
+            (unsigned long long)interval.lost,
+            (unsigned long long)interval.duplicates,
+            (unsigned long long)interval.corrupt,
+            (unsigned long long)interval.truncated);
+
+    interval = Counts();
+    intervalStart = now;
+}
+
+void ThroughputVerifier::print(FILE *fp) const
+{
+    if (!started)
+    {
+        fprintf(fp, "No records received\n");
+        return;
+    }
+
+    double seconds = std::chrono::duration<double>(lastTime -
+                                                   startTime).count();
+    fprintf(fp, "%llu records, %llu lost, %llu duplicates, %llu corrupt, "
+            "%llu truncated, %llu restarts\n",
+            (unsigned long long)total.records,
+            (unsigned long long)total.lost,
+            (unsigned long long)total.duplicates,
+            (unsigned long long)total.corrupt,
+            (unsigned long long)total.truncated,
+            (unsigned long long)restarts);
+
+    if (seconds > 0)
+        fprintf(fp, "Sustained %.0f bytes/s, %.0f records/s over %.1fs\n",
+                total.bytes / seconds, total.records / seconds, seconds);
+
+    if (lossSeen)
+        fprintf(fp, "Loss started after %.1fs at record %u, rate %u/s\n",
+                lossTime, lossSequence, lossRate);
+    else
+        fprintf(fp, "No loss\n");
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#include <chrono>
+#include <string>
+
+// Checks the records sent by the throughput example for gaps, duplicates
+// and corruption and measures the rate they arrive at. Like CommandClient
+// it does no I/O and is given the bytes received from the target.
+//
+// When the probe falls behind SWDStream overwrites the oldest output, so
+// loss shows up as a line missing its start followed by a jump in the
+// sequence number. Such fragments are counted as truncated and only
+// records that are complete but fail the CRC are counted as corrupt.
+class ThroughputVerifier
+{
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    struct Counts
+    {
+        uint64_t bytes;
+        uint64_t records;
+        uint64_t lost;
+        uint64_t duplicates;
+        uint64_t corrupt;
+        uint64_t truncated;
+    };
+
+    ThroughputVerifier();
+
+    void receive(const uint8_t *data, size_t size);
+
+    // If a second has passed since the last interval started, print the
+    // counts for it and start another
+    void update(FILE *fp);
+
+    // Print totals, the sustained rate and when loss started
+    void print(FILE *fp) const;
+
+    const Counts &getTotal() const { return total; }
+    bool hasLoss() const { return lossSeen; }
+
+protected:
+    std::string line;
+
+    bool started;
+    uint32_t lastSequence;
+    uint32_t lastRate;
+    uint64_t restarts;
+    Clock::time_point startTime;
+    Clock::time_point lastTime;
+
+    Counts total;
+    Counts interval;
+    Clock::time_point intervalStart;
+
+    bool lossSeen;
+    double lossTime;
+    uint32_t lossSequence;
+    uint32_t lossRate;
+
+    void processLine(const std::string &l);
+    void countLoss(uint64_t n);
+};
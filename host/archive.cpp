@@ -0,0 +1,143 @@
+#include "Archive.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <iostream>
+#include <string>
+
+#include <cxxopts.hpp>
+
+// Seconds since the epoch or local time as "YYYY-MM-DD HH:MM:SS"
+static bool parseTime(const std::string &text, uint64_t &us)
+{
+    char *end;
+    double seconds = strtod(text.c_str(), &end);
+    if (*end == '\0' && !text.empty())
+    {
+        us = seconds * 1e6;
+        return true;
+    }
+
+    struct tm tm = {};
+    const char *rest = strptime(text.c_str(), "%Y-%m-%d %H:%M:%S", &tm);
+    if (rest == nullptr || *rest != '\0')
+    {
+        std::cerr << "Bad time '" << text << "'\n";
+        return false;
+    }
+
+    tm.tm_isdst = -1;
+    us = (uint64_t)mktime(&tm) * 1000000;
+    return true;
+}
+
+static std::string formatTime(uint64_t us)
+{
+    time_t t = us / 1000000;
+    struct tm tm;
+    localtime_r(&t, &tm);
+
+    char buf[64];
+    size_t n = strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", &tm);
+    snprintf(buf + n, sizeof(buf) - n, ".%06u", (unsigned)(us % 1000000));
+    return buf;
+}
+
+int main(int argc, char **argv)
+{
+    cxxopts::Options options("archive", "Read a monitor output archive");
+    options.add_options()
+        ("f,from", "Start time", cxxopts::value<std::string>())
+        ("t,to", "End time", cxxopts::value<std::string>())
+        ("target-from", "Start target counter", cxxopts::value<uint64_t>())
+        ("target-to", "End target counter", cxxopts::value<uint64_t>())
+        ("l,list", "List the segments")
+        ("T,times", "Show the host time of each chunk")
+        ("archive", "Archive name", cxxopts::value<std::string>())
+        ("h,help", "Show usage");
+    options.parse_positional({ "archive" });
+    options.positional_help("ARCHIVE");
+
+    std::string name;
+    uint64_t from = 0, to = UINT64_MAX;
+    bool by_target = false;
+    bool list, times;
+    try
+    {
+        auto result = options.parse(argc, argv);
+        if (result.count("help") || !result.count("archive"))
+        {
+            std::cout << options.help() << "\n";
+            return result.count("help") ? 0 : 1;
+        }
+
+        name = result["archive"].as<std::string>();
+        if (result.count("from") &&
+            !parseTime(result["from"].as<std::string>(), from))
+            return 1;
+        if (result.count("to") &&
+            !parseTime(result["to"].as<std::string>(), to))
+            return 1;
+
+        if (result.count("target-from") || result.count("target-to"))
+        {
+            by_target = true;
+            from = result.count("target-from") ?
+                result["target-from"].as<uint64_t>() : 0;
+            to = result.count("target-to") ?
+                result["target-to"].as<uint64_t>() : UINT64_MAX;
+        }
+
+        list = result.count("list") > 0;
+        times = result.count("times") > 0;
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << e.what() << "\n";
+        return 1;
+    }
+
+    ArchiveReader reader;
+    if (!reader.open(name))
+        return 1;
+
+    if (list)
+    {
+        for (const ArchiveIndexEntry &e : reader.getIndex())
+            printf("%12llu %8u -> %8u  %s - %s  target %llu - %llu\n",
+                   (unsigned long long)e.offset, e.size, e.compressedSize,
+                   formatTime(e.firstHost).c_str(),
+                   formatTime(e.lastHost).c_str(),
+                   (unsigned long long)e.firstTarget,
+                   (unsigned long long)e.lastTarget);
+        return 0;
+    }
+
+    bool line_start = true;
+    auto print = [&](uint64_t host, uint64_t /*target*/, const uint8_t *data,
+                     size_t size) {
+        if (!times)
+        {
+            fwrite(data, 1, size, stdout);
+            return;
+        }
+
+        // Put the time of the chunk at the start of each of its lines
+        std::string stamp = "[" + formatTime(host) + "] ";
+        for (size_t i = 0; i < size; i++)
+        {
+            if (line_start)
+                fputs(stamp.c_str(), stdout);
+            fputc(data[i], stdout);
+            line_start = (data[i] == '\n');
+        }
+    };
+
+    bool ok = by_target ? reader.readTarget(from, to, print) :
+        reader.readHost(from, to, print);
+
+    return ok ? 0 : 1;
+}
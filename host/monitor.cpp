@@ -1,18 +1,42 @@
+#include "Archive.h"
+#include "Calibration.h"
+#include "Channel.h"
+#include "ClockSync.h"
+#include "CommandClient.h"
+#include "CoreDump.h"
+#include "LineFilter.h"
+#include "LogMerger.h"
+#include "PCSampler.h"
+#include "Profile.h"
+#include "Recording.h"
+#include "RemoteProbe.h"
+#include "Snapshot.h"
 #include "STLink.h"
+#include "ThroughputVerifier.h"
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <ctype.h>
 #include <unistd.h>
 #include <signal.h>
 #include <termios.h>
 #include <fcntl.h>
 #include <string.h>
 
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <memory>
 #include <vector>
 #include <string>
+#include <fstream>
 #include <iostream>
 
-#define SWDPRINT_MAGIC  0xd5715e0c
-#define SWDSTREAM_MAGIC 0xd5715e0d
+#include <cxxopts.hpp>
+
+// Most program counter samples taken between console polls
+#define PC_SAMPLE_BATCH 32
 
 static volatile bool running = true;
 
@@ -21,67 +45,753 @@ void intHandler(int /*sig*/)
     running = false;
 }
 
+static bool loadCommands(const std::string &filename, CommandClient &client,
+                         size_t &count)
+{
+    std::ifstream file;
+    std::istream *in = &std::cin;
+    if (filename != "-")
+    {
+        file.open(filename);
+        if (!file)
+        {
+            std::cerr << "Could not open " << filename << "\n";
+            return false;
+        }
+
+        in = &file;
+    }
+
+    count = 0;
+    std::string line;
+    while (std::getline(*in, line))
+    {
+        // Skip blank lines and comments
+        size_t start = line.find_first_not_of(" \t\r");
+        if (start == std::string::npos || line[start] == '#')
+            continue;
+
+        size_t end = line.find_last_not_of(" \t\r");
+        client.queue(line.substr(start, end - start + 1));
+        count++;
+    }
+
+    return true;
+}
+
+// Parse a log mask given as a number or a comma separated list of a level
+// name and category numbers such as "debug,3,7". All categories are
+// enabled if none are given. See src/SWDLog.h
+static bool parseLogMask(const std::string &text, uint32_t &mask)
+{
+    static const char *levels[] = { "error", "warn", "info", "debug", "trace" };
+
+    char *end;
+    mask = strtoul(text.c_str(), &end, 0);
+    if (*end == '\0' && !text.empty())
+        return true;
+
+    uint32_t level_bits = 0;
+    uint32_t categories = 0;
+    size_t pos = 0;
+    while (pos <= text.size())
+    {
+        size_t comma = text.find(',', pos);
+        if (comma == std::string::npos)
+            comma = text.size();
+        std::string item = text.substr(pos, comma - pos);
+        pos = comma + 1;
+
+        bool found = false;
+        for (size_t i = 0; i < sizeof(levels) / sizeof(levels[0]); i++)
+        {
+            if (item == levels[i])
+            {
+                // Each level includes the ones above it
+                level_bits = (2 << i) - 1;
+                found = true;
+            }
+        }
+
+        if (found)
+            continue;
+
+        unsigned long cat = strtoul(item.c_str(), &end, 10);
+        if (item.empty() || *end != '\0' || cat > 23)
+        {
+            std::cerr << "Bad log mask item '" << item << "'\n";
+            return false;
+        }
+
+        categories |= (uint32_t)1 << (8 + cat);
+    }
+
+    mask = level_bits | (categories ? categories : 0xffffff00);
+    return true;
+}
+
+// Parse a memory range given as address:size in hex
+static bool parseRange(const std::string &text,
+                       std::pair<size_t, size_t> &range)
+{
+    size_t colon = text.find(':');
+    if (colon != std::string::npos && colon > 0 && colon + 1 < text.size() &&
+        isxdigit((unsigned char)text[0]) &&
+        isxdigit((unsigned char)text[colon + 1]))
+    {
+        char *end;
+        range.first = strtoul(text.c_str(), &end, 16);
+        if (end == text.c_str() + colon)
+        {
+            range.second = strtoul(text.c_str() + colon + 1, &end, 16);
+            if (*end == '\0' && range.second > 0)
+                return true;
+        }
+    }
+
+    std::cerr << "Range '" << text << "' is not address:size in hex\n";
+    return false;
+}
+
+// Halt the target and write its registers and memory to an ELF core file
+static bool dumpCore(const std::string &filename,
+                     const std::vector<std::pair<size_t, size_t>> &ranges,
+                     Probe &probe, STLink *stlink)
+{
+    CoreDump dump;
+
+    size_t ram_base, ram_size;
+    probe.getRAM(ram_base, ram_size);
+    dump.addRegion(ram_base, ram_size);
+
+    for (const std::pair<size_t, size_t> &r : ranges)
+        dump.addRegion(r.first, r.second);
+
+    std::chrono::steady_clock::time_point start =
+        std::chrono::steady_clock::now();
+
+    if (stlink != nullptr)
+    {
+        uint32_t regs[CORE_DUMP_REGISTERS];
+        if (!stlink->halt())
+            return false;
+
+        if (stlink->readRegisters(regs))
+            dump.setRegisters(regs);
+    }
+
+    bool ok = dump.read(probe);
+
+    if (stlink != nullptr && !stlink->resume())
+        ok = false;
+
+    if (!ok)
+        return false;
+
+    double elapsed = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - start).count();
+    fprintf(stderr, "Read %zu bytes in %.3fs, %.0f bytes/s\n",
+            dump.getSize(), elapsed, dump.getSize() / elapsed);
+
+    return dump.write(filename);
+}
+
+// Write a line with the host time, id, sequence and data in hex for each
+// snapshot that has changed. Returns false on a probe error
+static bool readSnapshots(std::vector<Snapshot> &snapshots,
+                          std::vector<uint32_t> &sequences, FILE *fp)
+{
+    std::vector<uint8_t> value;
+    for (size_t i = 0; i < snapshots.size(); i++)
+    {
+        uint32_t sequence;
+        int res = snapshots[i].read(value, sequence);
+        if (res < 0)
+            return false;
+        if (res == 0 || sequence == sequences[i])
+            continue;
+
+        sequences[i] = sequence;
+
+        double now = std::chrono::duration<double>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+        fprintf(fp, "%.6f %u %u ", now, snapshots[i].getId(), sequence);
+        for (uint8_t b : value)
+            fprintf(fp, "%02x", b);
+        fputc('\n', fp);
+    }
+
+    return true;
+}
+
+static void printResult(const CommandClient::Result &r)
+{
+    printf("> %s\n", r.command.c_str());
+    for (const std::string &l : r.lines)
+        printf("%s\n", l.c_str());
+
+    printf("%s%s %.3fms\n", r.ok ? "OK" : "ERROR",
+           r.crcError ? " (CRC error)" : "", r.latency * 1e3);
+}
+
+// Host time and position of each line start in some decoded output
+typedef std::vector<std::pair<LogMerger::Clock::time_point, size_t>>
+    MergeStamps;
+
+// One target in the merged output
+struct MergeProbe
+{
+    std::string tag;
+    STLink stlink;
+    ClockSync clock;
+    std::deque<Channel> channels;
+    std::deque<TimestampDecoder> decoders;
+};
+
+// Interleave the output of all the channels on several probes in time
+// order. Each probe is given as SERIAL or SERIAL=TAG. Without timestamps
+// lines are ordered by when they were read, with them by when they were
+// written
+static int runMerge(const std::vector<std::string> &probe_specs,
+                    double window, bool timestamps, size_t counter_address,
+                    double duration)
+{
+    std::vector<std::string> specs = probe_specs;
+    if (specs.empty())
+        specs = STLink::list();
+    if (specs.empty())
+    {
+        fprintf(stderr, "No probes found\n");
+        return 1;
+    }
+
+    LogMerger merger([](const char *data, size_t size) {
+        write(STDOUT_FILENO, data, size);
+    });
+    merger.setWindow(window);
+
+    std::vector<std::unique_ptr<MergeProbe>> probes;
+    ChannelSet channels;
+    for (const std::string &spec : specs)
+    {
+        size_t eq = spec.find('=');
+        std::string serial = spec.substr(0, eq);
+
+        probes.emplace_back(new MergeProbe());
+        MergeProbe &p = *probes.back();
+        p.tag = eq == std::string::npos ? serial : spec.substr(eq + 1);
+
+        if (!p.stlink.open(serial))
+            return 1;
+
+        // Measuring every probe would take too long so only use saved
+        // settings
+        Calibration calibration(p.stlink);
+        if (calibration.load())
+            calibration.apply();
+
+        std::vector<Channel::Location> locations = Channel::find(p.stlink);
+        if (locations.empty())
+        {
+            fprintf(stderr, "%s: Did not find any SWD magic numbers in "
+                    "memory\n", p.tag.c_str());
+            return 1;
+        }
+
+        p.clock.setCounterAddress(counter_address);
+        for (size_t i = 0; i < locations.size(); i++)
+        {
+            std::string tag = p.tag;
+            if (locations.size() > 1)
+                tag += ":" + std::to_string(i);
+            size_t source = merger.addSource(tag);
+            fprintf(stderr, "%s: 0x%zx\n", tag.c_str(), locations[i].address);
+
+            p.channels.emplace_back(p.stlink, locations[i]);
+            Channel &channel = p.channels.back();
+            ClockSync &clock = p.clock;
+            channel.setResetCallback([&clock, tag]() {
+                fprintf(stderr, "%s: Target reset\n", tag.c_str());
+                clock.restart();
+            });
+
+            if (timestamps)
+            {
+                p.decoders.emplace_back(p.clock);
+                TimestampDecoder &decoder = p.decoders.back();
+                decoder.setPrint(false);
+
+                // Split the decoded text at the start of each line so every
+                // line gets the time it was written
+                std::shared_ptr<MergeStamps> stamps(new MergeStamps());
+                decoder.setStampCallback([stamps](LogMerger::Clock::time_point t,
+                                                  size_t pos) {
+                    stamps->push_back(std::make_pair(t, pos));
+                });
+                channel.setReadCallback([&merger, &decoder, stamps, source](
+                                            const uint8_t *data, size_t size) {
+                    std::string text;
+                    stamps->clear();
+                    decoder.decode(data, size, text);
+
+                    LogMerger::Clock::time_point now =
+                        LogMerger::Clock::now();
+                    size_t pos = 0;
+                    for (const auto &s : *stamps)
+                    {
+                        merger.receive(source, text.data() + pos,
+                                       s.second - pos, now);
+                        pos = s.second;
+                        now = s.first;
+                    }
+                    merger.receive(source, text.data() + pos,
+                                   text.size() - pos, now);
+                });
+            }
+            else
+            {
+                channel.setReadCallback([&merger, source](const uint8_t *data,
+                                                          size_t size) {
+                    merger.receive(source, (const char *)data, size,
+                                   LogMerger::Clock::now());
+                });
+            }
+
+            channels.add(&channel);
+        }
+
+        if (timestamps && !p.clock.sample(p.stlink))
+            return 1;
+    }
+
+    // Second sample for the first estimate of each clock rate
+    if (timestamps)
+    {
+        usleep(10000);
+        for (std::unique_ptr<MergeProbe> &p : probes)
+            if (!p->clock.sample(p->stlink))
+                return 1;
+    }
+
+    std::chrono::steady_clock::time_point start =
+        std::chrono::steady_clock::now();
+    std::chrono::steady_clock::time_point next_sample = start;
+    channels.setReattach(true);
+    bool ok = channels.run([&]() {
+        std::chrono::steady_clock::time_point now =
+            std::chrono::steady_clock::now();
+        if (duration > 0 &&
+            std::chrono::duration<double>(now - start).count() >= duration)
+            return false;
+
+        // A failed sample is left to the next poll to handle
+        if (timestamps && now >= next_sample && !channels.isReconnecting())
+        {
+            for (std::unique_ptr<MergeProbe> &p : probes)
+                p->clock.sample(p->stlink);
+            next_sample = now + std::chrono::milliseconds(100);
+        }
+
+        merger.flush(now);
+
+        return (bool)running;
+    });
+
+    merger.flushAll();
+    fprintf(stderr, "%lu lines merged from %zu probes, %lu out of order\n",
+            merger.getLines(), probes.size(), merger.getLate());
+
+    for (std::unique_ptr<MergeProbe> &p : probes)
+        p->stlink.close();
+
+    return ok ? 0 : 1;
+}
+
 int main(int argc, char **argv)
 {
+    cxxopts::Options options("monitor", "Console over the SWD interface");
+    options.add_options()
+        ("e,exec", "Run CommandParser commands from a file (- for stdin)",
+         cxxopts::value<std::string>())
+        ("w,window", "Number of commands in flight",
+         cxxopts::value<int>()->default_value("8"))
+        ("c,crc", "Add CRC16 checksums to commands and check responses")
+        ("a,address", "RS485 address of the target in hex",
+         cxxopts::value<std::string>())
+        ("t,timeout", "Command response timeout in ms",
+         cxxopts::value<int>()->default_value("2000"))
+        ("n,channel", "Control block to use if there are several",
+         cxxopts::value<int>()->default_value("0"))
+        ("record", "Log all probe transfers to a file",
+         cxxopts::value<std::string>())
+        ("server", "Use the probe through a probed server on this socket",
+         cxxopts::value<std::string>()->implicit_value(PROBE_SERVER_SOCKET))
+        ("replay", "Use a recording instead of the probe",
+         cxxopts::value<std::string>())
+        ("realtime", "Replay with the original timing rather than as fast "
+         "as possible")
+        ("verify", "Check the output of the throughput example")
+        ("rate", "Records per second for the throughput example",
+         cxxopts::value<int>())
+        ("size", "Record size for the throughput example",
+         cxxopts::value<int>())
+        ("ramp", "Records per second added each second by the throughput "
+         "example", cxxopts::value<int>())
+        ("timestamps", "Show the time of each line from SWDSTREAM_TIMESTAMP "
+         "firmware")
+        ("counter", "Address of the timestamp counter in hex",
+         cxxopts::value<std::string>()->default_value("E0001004"))
+        ("i,include", "Only show lines containing this text",
+         cxxopts::value<std::vector<std::string>>())
+        ("x,exclude", "Do not show lines containing this text",
+         cxxopts::value<std::vector<std::string>>())
+        ("E,regex", "Include and exclude patterns are regular expressions")
+        ("highlight", "Highlight the included text")
+        ("l,log-mask", "Set the firmware log mask to a number or a level and "
+         "categories such as debug,2,5", cxxopts::value<std::string>())
+        ("dump", "Write the registers and RAM to an ELF core file and exit",
+         cxxopts::value<std::string>())
+        ("dump-range", "Also dump address:size given in hex",
+         cxxopts::value<std::vector<std::string>>())
+        ("profile", "Show the SWD_PROFILE cycle counts and exit")
+        ("pc-sample", "Sample the program counter and show the busiest "
+         "functions in this firmware ELF file at exit",
+         cxxopts::value<std::string>())
+        ("pc-rate", "Program counter samples per second",
+         cxxopts::value<int>()->default_value("1000"))
+        ("folded", "Write the program counter samples as folded stacks",
+         cxxopts::value<std::string>())
+        ("calibrate", "Measure the best SWD clock and transfer size for the "
+         "probe again")
+        ("archive", "Also write the output to a compressed archive",
+         cxxopts::value<std::string>())
+        ("snapshot", "Write each change of the SWDSnapshot blocks to a file "
+         "(- for stdout)", cxxopts::value<std::string>())
+        ("snapshot-rate", "Snapshot reads per second",
+         cxxopts::value<int>()->default_value("100"))
+        ("merge", "Interleave the output of all channels on several probes "
+         "in time order")
+        ("p,probe", "Probe SERIAL or SERIAL=TAG to merge, default all",
+         cxxopts::value<std::vector<std::string>>())
+        ("merge-window", "Time in ms to wait for late lines when merging",
+         cxxopts::value<int>()->default_value("50"))
+        ("no-reattach", "Exit on a probe error rather than waiting for the "
+         "target or probe to come back")
+        ("d,duration", "Stop after this many seconds",
+         cxxopts::value<double>()->default_value("0"))
+        ("h,help", "Show usage");
+
+    std::string exec_file;
+    std::string record_file;
+    std::string replay_file;
+    std::string server_socket;
+    bool realtime;
+    bool reattach;
+    bool verify_mode;
+    std::string throughput_config;
+    double duration;
+    bool timestamps;
+    size_t counter_address;
+    CommandClient client;
+    LineFilter filter;
+    bool set_log_mask = false;
+    uint32_t log_mask = 0;
+    bool calibrate;
+    bool show_profile;
+    std::string pc_elf;
+    int pc_rate;
+    std::string folded_file;
+    std::string archive_name;
+    std::string snapshot_file;
+    int snapshot_rate;
+    std::string dump_file;
+    std::vector<std::pair<size_t, size_t>> dump_ranges;
+    bool merge;
+    std::vector<std::string> merge_probes;
+    double merge_window;
+    double timeout;
+    size_t channel_num;
+    try
+    {
+        auto result = options.parse(argc, argv);
+        if (result.count("help"))
+        {
+            std::cout << options.help() << "\n";
+            return 0;
+        }
+
+        if (result.count("exec"))
+            exec_file = result["exec"].as<std::string>();
+
+        client.setWindow(result["window"].as<int>());
+        client.setCRC(result.count("crc") > 0);
+        if (result.count("address"))
+            client.setAddress(std::stoi(result["address"].as<std::string>(),
+                                        nullptr, 16));
+
+        timeout = result["timeout"].as<int>() / 1000.0;
+        channel_num = result["channel"].as<int>();
+
+        if (result.count("record"))
+            record_file = result["record"].as<std::string>();
+        if (result.count("replay"))
+            replay_file = result["replay"].as<std::string>();
+        if (result.count("server"))
+            server_socket = result["server"].as<std::string>();
+        realtime = result.count("realtime") > 0;
+        reattach = result.count("no-reattach") == 0;
+
+        verify_mode = result.count("verify") > 0;
+        for (const char *opt : { "rate", "size", "ramp" })
+            if (result.count(opt))
+                throughput_config += std::string(opt) + " " +
+                    std::to_string(result[opt].as<int>()) + "\n";
+
+        duration = result["duration"].as<double>();
+
+        timestamps = result.count("timestamps") > 0;
+        counter_address = std::stoul(result["counter"].as<std::string>(),
+                                     nullptr, 16);
+
+        bool regex = result.count("regex") > 0;
+        if (result.count("include"))
+            for (const std::string &p :
+                     result["include"].as<std::vector<std::string>>())
+                if (!filter.addInclude(p, regex))
+                    return 1;
+        if (result.count("exclude"))
+            for (const std::string &p :
+                     result["exclude"].as<std::vector<std::string>>())
+                if (!filter.addExclude(p, regex))
+                    return 1;
+        filter.setHighlight(result.count("highlight") > 0);
+
+        calibrate = result.count("calibrate") > 0;
+        show_profile = result.count("profile") > 0;
+        if (result.count("pc-sample"))
+            pc_elf = result["pc-sample"].as<std::string>();
+        pc_rate = result["pc-rate"].as<int>();
+        if (result.count("folded"))
+            folded_file = result["folded"].as<std::string>();
+
+        if (result.count("archive"))
+            archive_name = result["archive"].as<std::string>();
+
+        if (result.count("snapshot"))
+            snapshot_file = result["snapshot"].as<std::string>();
+        snapshot_rate = result["snapshot-rate"].as<int>();
+
+        if (result.count("dump"))
+            dump_file = result["dump"].as<std::string>();
+        if (result.count("dump-range"))
+        {
+            for (const std::string &r :
+                     result["dump-range"].as<std::vector<std::string>>())
+            {
+                dump_ranges.emplace_back();
+                if (!parseRange(r, dump_ranges.back()))
+                    return 1;
+            }
+        }
+
+        merge = result.count("merge") > 0;
+        if (result.count("probe"))
+            merge_probes = result["probe"].as<std::vector<std::string>>();
+        merge_window = result["merge-window"].as<int>() / 1000.0;
+
+        if (result.count("log-mask"))
+        {
+            if (!parseLogMask(result["log-mask"].as<std::string>(), log_mask))
+                return 1;
+            set_log_mask = true;
+        }
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << e.what() << "\n";
+        return 1;
+    }
+
+    bool exec_mode = !exec_file.empty();
+    size_t num_commands = 0;
+    if (exec_mode)
+    {
+        if (!loadCommands(exec_file, client, num_commands))
+            return 1;
+
+        client.setResultCallback(printResult);
+    }
+
     signal(SIGINT, intHandler);
     signal(SIGTERM, intHandler);
     signal(SIGQUIT, intHandler);
-    
+
+    if (merge)
+        return runMerge(merge_probes, merge_window, timestamps,
+                        counter_address, duration);
+
+    bool replay_mode = !replay_file.empty();
+    bool server_mode = !server_socket.empty();
+    // Nothing to reconnect to in a recording
+    if (replay_mode)
+        reattach = false;
+
     STLink stlink;
+    ReplayProbe replay;
+    RemoteProbe remote;
+    Probe *probe = &stlink;
+    // Halting is only possible with the probe itself
+    STLink *halt_stlink = &stlink;
 
-    if (!stlink.open())
-        return 1;
+    if (replay_mode)
+    {
+        if (!replay.open(replay_file))
+            return 1;
 
-    size_t addr = 0;
+        replay.setRealTime(realtime);
+        probe = &replay;
+        halt_stlink = nullptr;
+    }
+    else if (server_mode)
+    {
+        if (!remote.open(server_socket))
+            return 1;
 
-    if (true)
+        remote.setTimeout(std::max(timeout, 5.0));
+        probe = &remote;
+        halt_stlink = nullptr;
+    }
+    else
     {
-        // Seatch for the magic address in the RAM
-        size_t ram_base, ram_size;
-        stlink.getRAM(ram_base, ram_size);
+        if (!stlink.open())
+            return 1;
+
+        // Use the saved settings for this probe or measure them
+        Calibration calibration(stlink);
+        if (calibrate || !calibration.load())
+        {
+            printf("Calibrating probe %s\n", stlink.getSerial().c_str());
+            if (calibration.run())
+                calibration.save();
+        }
 
-        std::vector<uint8_t> ram;
-        ram.resize(ram_size);
+        calibration.apply();
+        calibration.print(stdout);
+    }
+
+    RecordingProbe recording(*probe);
+    if (!record_file.empty())
+    {
+        if (!recording.open(record_file))
+            return 1;
 
-        printf("Reading RAM\n");
-        if (!stlink.read(ram.data(), ram_base, 0x1000))
+        probe = &recording;
+    }
+
+    // Do this first as the target may be about to be reset by a watchdog
+    if (!dump_file.empty())
+        return dumpCore(dump_file, dump_ranges, *probe, halt_stlink) ? 0 : 1;
+
+    if (show_profile)
+    {
+        Profile profile;
+        if (!profile.find(*probe))
         {
-            printf("Could not read ram\n");
+            printf("Did not find an SWD_PROFILE table in memory\n");
             return 1;
         }
 
-	// FIXME Need to addd SWDPRINT_MAGIC
-        uint32_t magic = SWDSTREAM_MAGIC;
-        uint8_t *magic_ptr = (uint8_t *)&magic;
-        
-        printf("Looking for SWD magic numbers in memory\n");
-        for (size_t i = 0; i < ram_size-3; i+=4)
+        std::vector<Profile::Entry> entries;
+        if (!profile.read(*probe, entries))
+            return 1;
+
+        Profile::print(stdout, entries);
+        return 0;
+    }
+
+    printf("Looking for SWD magic numbers in memory\n");
+    std::vector<Channel::Location> locations = Channel::find(*probe);
+    for (const Channel::Location &l : locations)
+        printf("Found %s at 0x%zx\n",
+               l.magic == SWDSTREAM_MAGIC ? "SWDSTREAM_MAGIC" : "SWDPRINT_MAGIC",
+               l.address);
+
+    if (channel_num >= locations.size())
+    {
+        printf("Did not find any SWD magic numbers in memory\n");
+        return 1;
+    }
+
+    Channel channel(*probe, locations[channel_num]);
+
+    if (set_log_mask)
+    {
+        if (!channel.setLogMask(log_mask))
+            return 1;
+
+        printf("Log mask set to 0x%08x\n", log_mask);
+    }
+    if (exec_mode && !channel.hasInput())
+    {
+        printf("Control block does not accept input\n");
+        return 1;
+    }
+
+    SymbolTable symbols;
+    if (!pc_elf.empty() && !symbols.load(pc_elf))
+        return 1;
+    PCSampler sampler(*probe, halt_stlink);
+    unsigned long pc_due = 0;
+
+    std::vector<Snapshot> snapshots;
+    std::vector<uint32_t> snapshot_sequences;
+    FILE *snapshot_fp = nullptr;
+    if (!snapshot_file.empty())
+    {
+        for (const Snapshot::Location &l : Snapshot::find(*probe))
         {
-            if (ram[i] == magic_ptr[0] &&
-                ram[i+1] == magic_ptr[1] &&
-                ram[i+2] == magic_ptr[2] &&
-                ram[i+3] == magic_ptr[3])
-            {
-                addr = ram_base + i;
-                break;
-            }
+            printf("Found SWDSNAPSHOT_MAGIC id %u size %u at 0x%zx\n",
+                   l.id, l.size, l.address);
+            snapshots.emplace_back(*probe, l);
         }
+        // Nothing matches the first read
+        snapshot_sequences.resize(snapshots.size(), UINT32_MAX);
 
-        if (addr == 0)
+        snapshot_fp = snapshot_file == "-" ? stdout :
+            fopen(snapshot_file.c_str(), "w");
+        if (snapshot_fp == nullptr)
         {
-            printf("Did not find any SWD magic numbers in memory\n");
-            
+            perror(snapshot_file.c_str());
             return 1;
         }
+    }
+
+    ClockSync clock;
+    clock.setCounterAddress(counter_address);
+    TimestampDecoder decoder(clock);
 
-        printf("Found SWDSTREAM_MAGIC number at 0x%zx\n", addr);
+    // Two samples to get a first estimate of the clock rate. Taken before
+    // the terminal is changed so a failure leaves it alone
+    if (timestamps)
+    {
+        if (!clock.sample(*probe))
+            return 1;
+        usleep(10000);
+        if (!clock.sample(*probe))
+            return 1;
     }
 
+    // Also before the terminal is changed
+    ArchiveWriter archive;
+    if (!archive_name.empty() && !archive.open(archive_name))
+        return 1;
+
     struct termios orig_tty;
-    
+
     bool is_tty = isatty(STDIN_FILENO);
-    bool need_raw_terminal = is_tty;
-   
+    bool need_raw_terminal = is_tty && !exec_mode && !replay_mode &&
+        !verify_mode;
+
     if (need_raw_terminal)
     {
         if (tcgetattr(STDIN_FILENO, &orig_tty) != 0)
@@ -115,127 +825,279 @@ int main(int argc, char **argv)
 
         printf("Exit with ^D\n");
     }
-        
-    size_t status_addr = addr + 4;
-    size_t out_buffer_addr = addr + 4 + 4;
-    size_t in_buffer_addr = addr + 4 + 4 + 256;
-    
-    while (running)
-    {
-        uint8_t status[4];
-        if (!stlink.read((uint8_t *)&status, status_addr, 4))
-            break;
-
-        uint8_t out_head = status[0];
-        uint8_t out_tail = status[1];
-        uint8_t in_head = status[2];
-        uint8_t in_tail = status[3];
-
-#if 0
-        printf("out_head=%d out_tail=%d in_head=%d in_tail=%d\n",
-               out_head, out_tail, in_head, in_tail);
-#endif
-
-        // If we do not perform any input of output then sleep for
-        // 1ms so we do not consume 100% CPU
-        bool active = false;
-        
-        // Read from buffer
-        if (out_head != out_tail)
-        {
-            uint8_t buffer[256];
-            int pos = 0;
-            // Writes go to the head and reads from the tail
-            if (out_head > out_tail)
-            {
-                if (!stlink.read(buffer, out_buffer_addr + out_tail + 1,
-                                 out_head - out_tail))
-                    break;
-                
-                pos = out_head - out_tail;
-            }
-            else
+
+    size_t output_bytes = 0;
+    ThroughputVerifier verifier;
+    Channel::ReadCallback sink;
+    if (verify_mode)
+    {
+        sink = [&verifier, &output_bytes](const uint8_t *data, size_t size) {
+            verifier.receive(data, size);
+            output_bytes += size;
+        };
+
+        if (channel.hasInput())
+            channel.write((const uint8_t *)throughput_config.data(),
+                          throughput_config.size());
+    }
+    else if (exec_mode)
+    {
+        sink = [&client](const uint8_t *data, size_t size) {
+            client.receive(data, size);
+        };
+        // Keep what does not fit for the next time around
+        channel.setWriteCallback([&client](uint8_t *buf, size_t max) {
+            return client.getOutput(buf, max);
+        });
+    }
+    else if (replay_mode)
+    {
+        // Only the target output is of interest
+        sink = [&output_bytes](const uint8_t *data, size_t size) {
+            write(STDOUT_FILENO, data, size);
+            output_bytes += size;
+        };
+    }
+    else
+    {
+        sink = [](const uint8_t *data, size_t size) {
+            write(STDOUT_FILENO, data, size);
+        };
+        channel.setWriteCallback([](uint8_t *buf, size_t max) -> size_t {
+            int res = (int)read(STDIN_FILENO, buf, max);
+            if (res <= 0)
+                return 0;
+
+            // FIXME Does not see the ^D if the input buffer is full
+            // as we never call into here
+
+            // If the buffer contains a ^D (EOT) character then exit
+            // after outputing the current text
+            uint8_t *eot_ptr = (uint8_t *)memchr(buf, '\x04', res);
+            if (eot_ptr != nullptr)
             {
-                // Buffer wrap around
-                // Read from the buffer before wrap around
-                if (out_tail < 255)
-                    stlink.read(buffer, out_buffer_addr + out_tail + 1,
-                                255 - out_tail);
-                pos = 255 - out_tail;
-                
-
-                // Read rest
-                if (out_head != 0)
-                {
-                    if (!stlink.read(buffer+pos, out_buffer_addr, out_head))
-                        break;
-                    
-                    pos += out_head;
-                }
+                res = eot_ptr - buf;
+                running = false;
             }
 
-            // Update the tail pointer to empty the buffer
-            out_tail = out_head;
+            return res;
+        });
+    }
 
-            if (!stlink.write(&out_tail, status_addr + 1, 1))
-                break;
+    // Filter what goes to the terminal. Partial lines are held until they
+    // are complete
+    Channel::ReadCallback unfiltered = sink;
+    if (!filter.empty() && !exec_mode && !verify_mode)
+    {
+        sink = [&filter, unfiltered](const uint8_t *data, size_t size) {
+            std::string text;
+            filter.process((const char *)data, size, text);
+            if (!text.empty())
+                unfiltered((const uint8_t *)text.data(), text.size());
+        };
+    }
+
+    // Archive all the output before it is filtered
+    if (!archive_name.empty())
+    {
+        Channel::ReadCallback next = sink;
+        sink = [&archive, &decoder, next](const uint8_t *data, size_t size) {
+            archive.add(data, size, decoder.getLastTarget());
+            next(data, size);
+        };
+    }
+
+    // Timestamps are removed before the output goes anywhere else and only
+    // shown when it goes to the terminal
+    if (timestamps)
+    {
+        decoder.setPrint(!exec_mode && !verify_mode);
+        channel.setReadCallback([&decoder, sink](const uint8_t *data,
+                                                 size_t size) {
+            std::string text;
+            decoder.decode(data, size, text);
+            sink((const uint8_t *)text.data(), text.size());
+        });
+    }
+    else
+        channel.setReadCallback(sink);
 
-            write(STDOUT_FILENO, buffer, pos);
+    bool timed_out = false;
+    ChannelSet channels;
+    channels.add(&channel);
+    channels.setReattach(reattach);
 
-            active = true;
+    // The recording has the idle time in it already
+    if (replay_mode)
+        channels.setIdleSleep(0);
+
+    std::chrono::steady_clock::time_point start =
+        std::chrono::steady_clock::now();
+    std::chrono::steady_clock::time_point next_sample = start;
+    std::chrono::steady_clock::time_point next_snapshot = start;
+    std::chrono::steady_clock::duration snapshot_period =
+        std::chrono::microseconds(1000000 / std::max(snapshot_rate, 1));
+
+    // The firmware starts again with its default log mask, the counter from
+    // zero and its parser out of batch mode
+    channel.setResetCallback([&]() {
+        fprintf(stderr, "\nTarget reset\n");
+        if (set_log_mask)
+            channel.setLogMask(log_mask);
+        clock.restart();
+        next_sample = std::chrono::steady_clock::now();
+        if (exec_mode)
+            client.targetReset();
+    });
+
+    std::function<bool ()> hook = [&]() {
+        if (duration > 0 &&
+            std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                          start).count() >= duration)
+            return false;
+
+        archive.tick();
+
+        // Nothing else can use the probe until it is back
+        if (channels.isReconnecting())
+            return (bool)running;
+
+        if (verify_mode)
+            verifier.update(stderr);
+
+        // Keep the clock mapping up to date
+        // Errors are left to the next poll to handle when reattaching
+        if (timestamps && std::chrono::steady_clock::now() >= next_sample)
+        {
+            if (!clock.sample(*probe))
+                return reattach;
+            next_sample = std::chrono::steady_clock::now() +
+                std::chrono::milliseconds(100);
         }
 
-        // Write to buffer
-        uint8_t buffer[256];
-        uint8_t in_free = 255 - (in_head - in_tail);
-        if (in_free > 0)
+        std::chrono::steady_clock::time_point now =
+            std::chrono::steady_clock::now();
+
+        // Catch up on the samples due since the last time round in small
+        // batches so the console is still drained
+        if (!pc_elf.empty())
         {
-            int res = (int)read(STDIN_FILENO, buffer, in_free);
-            if (res > 0)
+            unsigned long target = std::chrono::duration<double>(
+                now - start).count() * pc_rate;
+            if (target > pc_due)
             {
-                active = true;
-
-                // FIXME Does not see the ^D if the output buffer is full
-                // as we never call into here
-                
-                // If the buffer contains a ^D (EOT) character then exit
-                // after outputing the current text
-                uint8_t *eot_ptr = (uint8_t *)memchr(buffer, '\x04', res);
-                if (eot_ptr != nullptr)
-                {
-                    res = eot_ptr - buffer;
-                    running = false;
-                }
-
-                int count = res;
-                if (in_head + count > 255)
-                    count = 255 - in_head;
-
-                // Write as much as possible to the end of the buffer
-                if (count > 0)
-                {
-                    stlink.write(buffer, in_buffer_addr + in_head + 1, count);
-                    res -= count;
-                    in_head += count;
-                }
-
-                // If still more then write as the head
-                if (res > 0)
-                {
-                    stlink.write(buffer, in_buffer_addr, res);
-                    in_head = res - 1;
-                }
-                
-                stlink.write(&in_head, status_addr + 2, 1);
+                unsigned int n = std::min(target - pc_due,
+                                          (unsigned long)PC_SAMPLE_BATCH);
+                if (!sampler.sample(n))
+                    return reattach;
+                pc_due += n;
+
+                // Give up on the ones the probe is too slow for
+                if (target > pc_due + PC_SAMPLE_BATCH)
+                    pc_due = target - PC_SAMPLE_BATCH;
             }
         }
-        
-        if (!active)
-            usleep(1000);
+        if (!snapshots.empty() && now >= next_snapshot)
+        {
+            if (!readSnapshots(snapshots, snapshot_sequences, snapshot_fp))
+                return reattach;
+
+            // Do not try to catch up after a stall
+            next_snapshot += snapshot_period;
+            if (next_snapshot < now)
+                next_snapshot = now;
+        }
+
+        if (exec_mode)
+        {
+            if (client.done())
+                return false;
+
+            if (client.oldestAge() > timeout)
+            {
+                timed_out = true;
+                return false;
+            }
+        }
+
+        return (bool)running;
+    };
+
+    // A failed read in a replay either failed in the recording too or is
+    // not in it. Carry on until the recording runs out
+    while (!channels.run(hook) && replay_mode && !replay.atEnd() && running)
+        ;
+
+    double elapsed = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - start).count();
+
+    std::string rest;
+    filter.flush(rest);
+    if (!rest.empty())
+        unfiltered((const uint8_t *)rest.data(), rest.size());
+
+    archive.close();
+    if (archive.getDropped() > 0)
+        fprintf(stderr, "%zu archive segments dropped\n",
+                archive.getDropped());
+
+    if (!pc_elf.empty())
+    {
+        sampler.printFlat(stderr, symbols);
+        fprintf(stderr, "%.0f samples/s\n",
+                elapsed > 0 ? sampler.getSamples() / elapsed : 0.0);
+        if (!folded_file.empty())
+            sampler.writeFolded(folded_file, symbols);
     }
 
+    for (const Snapshot &s : snapshots)
+        fprintf(stderr, "Snapshot %u: %lu reads, %lu retries, %lu torn\n",
+                s.getId(), s.getReads(), s.getRetries(), s.getFailures());
+    if (snapshot_fp != nullptr && snapshot_fp != stdout)
+        fclose(snapshot_fp);
+
+    recording.close();
+    remote.close();
     stlink.close();
-    
+
+    if (timestamps)
+    {
+        fprintf(stderr, "Target clock %.6f MHz, ring to host latency\n",
+                clock.getFrequency() / 1e6);
+        decoder.getLatency().print(stderr);
+    }
+
+    if (replay_mode)
+        fprintf(stderr, "Replayed %zu transfers (%zu skipped, %zu reads not "
+                "in the recording) and %zu bytes of output in %.3fs, "
+                "%.0f bytes/s\n", replay.getTransfers(), replay.getSkipped(),
+                replay.getMismatches(), output_bytes, elapsed,
+                elapsed > 0 ? output_bytes / elapsed : 0.0);
+
+    if (verify_mode)
+    {
+        verifier.print(stderr);
+
+        const ThroughputVerifier::Counts &total = verifier.getTotal();
+        return (total.records > 0 && total.lost == 0 &&
+                total.duplicates == 0 && total.corrupt == 0) ? 0 : 1;
+    }
+
+    if (exec_mode)
+    {
+        if (timed_out)
+            fprintf(stderr, "Timed out waiting for a response\n");
+
+        size_t completed = client.getLatency().count();
+        fprintf(stderr, "%zu of %zu commands completed, %zu errors, "
+                "%zu CRC errors\n", completed, num_commands,
+                client.getErrors(), client.getCRCErrors());
+        client.getLatency().print(stderr);
+
+        return (completed == num_commands && client.getErrors() == 0 &&
+                client.getCRCErrors() == 0) ? 0 : 1;
+    }
+
     printf("\nExit\n");
 
     if (need_raw_terminal)
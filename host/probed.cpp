@@ -0,0 +1,93 @@
+#include "Calibration.h"
+#include "ProbeServer.h"
+#include "STLink.h"
+
+#include <stdio.h>
+#include <signal.h>
+
+#include <iostream>
+#include <string>
+
+#include <cxxopts.hpp>
+
+static volatile bool running = true;
+
+static void intHandler(int /*sig*/)
+{
+    running = false;
+}
+
+int main(int argc, char **argv)
+{
+    cxxopts::Options options("probed", "Share an ST-Link between tools "
+                             "through a Unix socket");
+    options.add_options()
+        ("s,socket", "Socket path",
+         cxxopts::value<std::string>()->default_value(PROBE_SERVER_SOCKET))
+        ("serial", "Serial number of the probe to use",
+         cxxopts::value<std::string>())
+        ("calibrate", "Measure the best SWD clock and transfer size for the "
+         "probe again")
+        ("h,help", "Show usage");
+
+    std::string socket_path;
+    std::string serial;
+    bool calibrate;
+    try
+    {
+        auto result = options.parse(argc, argv);
+        if (result.count("help"))
+        {
+            std::cout << options.help() << "\n";
+            return 0;
+        }
+
+        socket_path = result["socket"].as<std::string>();
+        if (result.count("serial"))
+            serial = result["serial"].as<std::string>();
+        calibrate = result.count("calibrate") > 0;
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << e.what() << "\n";
+        return 1;
+    }
+
+    STLink stlink;
+    if (!stlink.open(serial))
+        return 1;
+
+    Calibration calibration(stlink);
+    if (calibrate || !calibration.load())
+    {
+        printf("Calibrating probe %s\n", stlink.getSerial().c_str());
+        if (calibration.run())
+            calibration.save();
+    }
+
+    calibration.apply();
+    calibration.print(stdout);
+
+    ProbeServer server(stlink);
+    if (!server.open(socket_path))
+        return 1;
+
+    signal(SIGINT, intHandler);
+    signal(SIGTERM, intHandler);
+    signal(SIGQUIT, intHandler);
+
+    printf("Serving probe %s on %s\n", stlink.getSerial().c_str(),
+           socket_path.c_str());
+    fflush(stdout);
+
+    bool ok = server.run([]() { return (bool)running; });
+
+    fprintf(stderr, "%lu clients, %lu reads in %lu batches, %lu bytes of "
+            "console output\n", server.getClients(), server.getReads(),
+            server.getBatches(), server.getOutputBytes());
+
+    server.close();
+    stlink.close();
+
+    return ok ? 0 : 1;
+}
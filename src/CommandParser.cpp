@@ -31,8 +31,78 @@ uint16_t _crc_ccitt_update(uint16_t crc, uint8_t data)
             ^ ((uint16_t)data << 3));
 }
 #endif
+
+// Table driven version of _crc_ccitt_update() used to checksum a whole
+// block of response output at once. Entry n is _crc_ccitt_update(0, n)
+static const uint16_t crcTable[256] PROGMEM =
+{
+    0x0000, 0x1189, 0x2312, 0x329b, 0x4624, 0x57ad, 0x6536, 0x74bf,
+    0x8c48, 0x9dc1, 0xaf5a, 0xbed3, 0xca6c, 0xdbe5, 0xe97e, 0xf8f7,
+    0x1081, 0x0108, 0x3393, 0x221a, 0x56a5, 0x472c, 0x75b7, 0x643e,
+    0x9cc9, 0x8d40, 0xbfdb, 0xae52, 0xdaed, 0xcb64, 0xf9ff, 0xe876,
+    0x2102, 0x308b, 0x0210, 0x1399, 0x6726, 0x76af, 0x4434, 0x55bd,
+    0xad4a, 0xbcc3, 0x8e58, 0x9fd1, 0xeb6e, 0xfae7, 0xc87c, 0xd9f5,
+    0x3183, 0x200a, 0x1291, 0x0318, 0x77a7, 0x662e, 0x54b5, 0x453c,
+    0xbdcb, 0xac42, 0x9ed9, 0x8f50, 0xfbef, 0xea66, 0xd8fd, 0xc974,
+    0x4204, 0x538d, 0x6116, 0x709f, 0x0420, 0x15a9, 0x2732, 0x36bb,
+    0xce4c, 0xdfc5, 0xed5e, 0xfcd7, 0x8868, 0x99e1, 0xab7a, 0xbaf3,
+    0x5285, 0x430c, 0x7197, 0x601e, 0x14a1, 0x0528, 0x37b3, 0x263a,
+    0xdecd, 0xcf44, 0xfddf, 0xec56, 0x98e9, 0x8960, 0xbbfb, 0xaa72,
+    0x6306, 0x728f, 0x4014, 0x519d, 0x2522, 0x34ab, 0x0630, 0x17b9,
+    0xef4e, 0xfec7, 0xcc5c, 0xddd5, 0xa96a, 0xb8e3, 0x8a78, 0x9bf1,
+    0x7387, 0x620e, 0x5095, 0x411c, 0x35a3, 0x242a, 0x16b1, 0x0738,
+    0xffcf, 0xee46, 0xdcdd, 0xcd54, 0xb9eb, 0xa862, 0x9af9, 0x8b70,
+    0x8408, 0x9581, 0xa71a, 0xb693, 0xc22c, 0xd3a5, 0xe13e, 0xf0b7,
+    0x0840, 0x19c9, 0x2b52, 0x3adb, 0x4e64, 0x5fed, 0x6d76, 0x7cff,
+    0x9489, 0x8500, 0xb79b, 0xa612, 0xd2ad, 0xc324, 0xf1bf, 0xe036,
+    0x18c1, 0x0948, 0x3bd3, 0x2a5a, 0x5ee5, 0x4f6c, 0x7df7, 0x6c7e,
+    0xa50a, 0xb483, 0x8618, 0x9791, 0xe32e, 0xf2a7, 0xc03c, 0xd1b5,
+    0x2942, 0x38cb, 0x0a50, 0x1bd9, 0x6f66, 0x7eef, 0x4c74, 0x5dfd,
+    0xb58b, 0xa402, 0x9699, 0x8710, 0xf3af, 0xe226, 0xd0bd, 0xc134,
+    0x39c3, 0x284a, 0x1ad1, 0x0b58, 0x7fe7, 0x6e6e, 0x5cf5, 0x4d7c,
+    0xc60c, 0xd785, 0xe51e, 0xf497, 0x8028, 0x91a1, 0xa33a, 0xb2b3,
+    0x4a44, 0x5bcd, 0x6956, 0x78df, 0x0c60, 0x1de9, 0x2f72, 0x3efb,
+    0xd68d, 0xc704, 0xf59f, 0xe416, 0x90a9, 0x8120, 0xb3bb, 0xa232,
+    0x5ac5, 0x4b4c, 0x79d7, 0x685e, 0x1ce1, 0x0d68, 0x3ff3, 0x2e7a,
+    0xe70e, 0xf687, 0xc41c, 0xd595, 0xa12a, 0xb0a3, 0x8238, 0x93b1,
+    0x6b46, 0x7acf, 0x4854, 0x59dd, 0x2d62, 0x3ceb, 0x0e70, 0x1ff9,
+    0xf78f, 0xe606, 0xd49d, 0xc514, 0xb1ab, 0xa022, 0x92b9, 0x8330,
+    0x7bc7, 0x6a4e, 0x58d5, 0x495c, 0x3de3, 0x2c6a, 0x1ef1, 0x0f78,
+};
+
+static uint16_t crcUpdateBlock(uint16_t crc, const char *data,
+                               unsigned int len)
+{
+    while (len-- > 0)
+        crc = (crc >> 8) ^ pgm_read_word(&crcTable[(crc ^ *data++) & 0xff]);
+
+    return crc;
+}
+#endif
+
+#if COMMAND_BINARY
+// Binary frame layout in the response buffer. A leading delimiter, the COBS
+// code then the address, command id and status
+#define BINARY_CODE_POS 1
+#define BINARY_HEADER 5
 #endif
 
+// Where poll() is in the line being received
+// Nothing yet
+#define LINE_START 0
+// In the @addr prefix
+#define LINE_ADDRESS 1
+// Spaces between the address and the command
+#define LINE_AFTER_ADDRESS 2
+// Command text for this device
+#define LINE_BODY 3
+// For another device so dropped
+#define LINE_SKIP 4
+// No @addr prefix when this device has an address so dropped
+#define LINE_NO_ADDRESS 5
+// A response from another device starting with * so dropped
+#define LINE_RESPONSE 6
+
 CommandParser::CommandParser(Stream &serial_,
                              const Command  * PROGMEM commands_,
                              uint8_t rs485_txen
@@ -47,8 +117,22 @@ CommandParser::CommandParser(Stream &serial_,
       needsPrompt(true),
 #endif
       rs485TXEN(rs485_txen),
-      readPos(0), writePos(0), needResponsePrefix(true),
-      rs485Address(0)
+      readPos(0), writePos(0), packetTooLong(false),
+      lineState(LINE_START), lineAddressDigits(0), lineAddress(0),
+#if COMMAND_INTERACTIVE
+      lineRescan(false),
+#endif
+      batch(false),
+#if COMMAND_BINARY
+      binary(false), binaryFrame(false),
+#endif
+      needResponsePrefix(true),
+      rs485Address(0),
+#if COMMAND_SUSPEND
+      suspended(0), suspendRequested(false), resumeState(0), resumePos(0),
+      chainOK(true),
+#endif
+      responsePos(0)
 {
     if (rs485TXEN > 0)
     {
@@ -66,6 +150,10 @@ CommandParser::CommandParser(Stream &serial_,
 #if COMMAND_CRC
     addCRC = false;
     crc = CRC_INITIAL;
+    crcPos = 0;
+    lineCRC = CRC_INITIAL;
+    lineExpectedCRC = 0;
+    lineHasCRC = false;
 #endif
 }
 
@@ -73,8 +161,29 @@ void CommandParser::clearBuffer()
 {
     readPos = 0;
     writePos = 0;
+    packetTooLong = false;
+    lineState = LINE_START;
+    lineAddressDigits = 0;
+    lineAddress = 0;
+#if COMMAND_CRC
+    lineCRC = CRC_INITIAL;
+    lineExpectedCRC = 0;
+    lineHasCRC = false;
+#endif
 }
 
+void CommandParser::setBatch(bool b)
+{
+    batch = b;
+}
+
+#if COMMAND_BINARY
+void CommandParser::setBinary(bool b)
+{
+    binary = b;
+}
+#endif
+
 uint8_t CommandParser::getRS485Address() const
 {
     return rs485Address;
@@ -87,31 +196,93 @@ void CommandParser::setRS485Address(uint8_t addr)
 
 void CommandParser::poll()
 {
-    while (serial.available())
+    SWD_PROFILE_SCOPE(PROFILE_POLL);
+
+    // Send anything printed outside of a command before echoing input
+    flush();
+
+#if COMMAND_SUSPEND
+    if (suspended != 0)
     {
-	if (writePos >= MAX_PACKET)
-	{
-	    writePos = 0;
+        // Input waits for the command to complete. A Ctrl-C is left to be
+        // read below so it also clears the line and batch mode
+        if (serial.peek() == 0x03)
+            cancel();
+        else
+        {
+            resume();
 
-#if COMMAND_STATS
-            statsMaxPacketLength++;
+            // Keep the RS485 bus and skip the prompt until it completes
+            if (suspended != 0)
+            {
+                flush();
+                return;
+            }
+        }
+    }
 #endif
-	    return;
-	}
 
+    while (serial.available())
+    {
 	char c = serial.read();
 
+#if COMMAND_BINARY
+        if (binaryFrame)
+        {
+            // Everything up to the next NUL is part of the COBS encoded frame
+            if (c != 0)
+            {
+                if (writePos < COMMAND_MAX_PACKET)
+                    buffer[writePos++] = c;
+                else
+                    packetTooLong = true;
+            }
+            else if (writePos > 0 || packetTooLong)
+            {
+                processFrame();
+
+#if COMMAND_SUSPEND
+                if (suspended != 0)
+                {
+                    flush();
+                    return;
+                }
+#endif
+            }
+
+            continue;
+        }
+        else if (binary && c == 0 && lineState == LINE_START)
+        {
+            // The frame reuses the response buffer so first send any text
+            // still held from earlier commands such as in batch mode
+            flush();
+            binaryFrame = true;
+            continue;
+        }
+#endif
+
 	if (c == '\r' || c == '\n')
         {
 #if COMMAND_INTERACTIVE
-            if (interactive)
+            if (interactive && !batch)
                 serial.write("\r\n");
 #endif
             processPacket();
+
+#if COMMAND_SUSPEND
+            // Leave the rest of the input until the command completes
+            if (suspended != 0)
+            {
+                flush();
+                return;
+            }
+#endif
         }
         else if (c == 0x03) // Ctrl-C
         {
             clearBuffer();
+            batch = false;
 
 #if COMMAND_INTERACTIVE
             if (interactive)
@@ -119,13 +290,20 @@ void CommandParser::poll()
             needsPrompt = true;
 #endif
         }
+        else if (c == 0x02) // Ctrl-B
+        {
+            // Host scripts send this to pipeline commands without echo
+            // and prompts
+            batch = true;
+        }
 #if COMMAND_INTERACTIVE
-        else if (interactive && (c == 0x08 || c == 0x7f)) // Backspace or Delete
+        else if (interactive && !batch && (c == 0x08 || c == 0x7f)) // Backspace or Delete
         {
             if (writePos > 0)
             {
                 serial.write("\x08 \x08");
                 writePos--;
+                rescanLine();
             }
         }
 #endif
@@ -137,23 +315,182 @@ void CommandParser::poll()
             statsIllegalCharacter++;
 #endif
         }
-	else if (writePos == 0 || buffer[0] != '*')
-	{
+        else
+            addChar(c);
+    }
+
+    releaseOutput();
+}
+
+// Take the next printable character of a line. The @addr prefix is checked
+// as soon as it ends and the rest of a line for another device is dropped
+// without being buffered. The CRC is updated as each character is stored
+void CommandParser::addChar(char c)
+{
 #if COMMAND_INTERACTIVE
-            if (interactive)
-                serial.write(c);
+    // Everything typed is kept while the line can still be edited so a
+    // backspace can change where it is going
+    bool editing = interactive && !batch;
+#else
+    bool editing = false;
 #endif
 
-	    // Only copy characters into the command buffer if it is not
-	    // a response to another command. Otherwise long responses exceed
-	    // MAX_PACKET length and cause output conflicts
-	    buffer[writePos++] = c;
-	}
+    switch (lineState)
+    {
+    case LINE_START:
+        if (c == '*')
+        {
+            // Responses from other devices on the RS485 bus. Buffering them
+            // would overflow COMMAND_MAX_PACKET and cause output conflicts
+            lineState = LINE_RESPONSE;
+            if (editing)
+                storeChar(c);
+            return;
+        }
+
+        if (c == '@')
+        {
+            lineState = LINE_ADDRESS;
+            storeChar(c);
+            return;
+        }
+
+        // If the command parser has an address and no address is supplied
+        // in the command then drop it. This stops multiple devices
+        // fighting when there are bus errors
+        lineState = rs485Address != 0 ? LINE_NO_ADDRESS : LINE_BODY;
+        break;
+
+    case LINE_ADDRESS:
+    {
+        // Spaces are allowed before the hex digits
+        int v = convertNimble(c);
+        if (v >= 0 || (c == ' ' && lineAddressDigits == 0))
+        {
+            if (v >= 0)
+            {
+                lineAddress = lineAddress * 16 + v;
+                lineAddressDigits++;
+            }
+
+            storeChar(c);
+            return;
+        }
+
+        if (!endAddress())
+            break;
     }
+    // Fall through - this character may start the command
 
-    releaseOutput();
+    case LINE_AFTER_ADDRESS:
+        if (c == ' ')
+        {
+            storeChar(c);
+            readPos = writePos;
+            return;
+        }
+
+        lineState = LINE_BODY;
+        break;
+
+    case LINE_RESPONSE:
+        return;
+
+    default:
+        break;
+    }
+
+    if (lineState != LINE_BODY)
+    {
+        if (editing)
+            storeChar(c);
+        return;
+    }
+
+#if COMMAND_CRC
+    if (storeChar(c))
+        lineCRCChar(c);
+#else
+    storeChar(c);
+#endif
+}
+
+// Add a character to the buffer and echo it. Returns false if the line is
+// too long
+bool CommandParser::storeChar(char c)
+{
+    if (writePos >= COMMAND_MAX_PACKET)
+    {
+        // Drop the rest of the line. An error is reported when the end of
+        // the line arrives
+        packetTooLong = true;
+        return false;
+    }
+
+    echo(c);
+    buffer[writePos++] = c;
+    return true;
+}
+
+#if COMMAND_INTERACTIVE
+// Work out the state of the line again after a backspace. While editing
+// every character is in the buffer so they are just taken again
+void CommandParser::rescanLine()
+{
+    CommandPos size = writePos;
+    bool too_long = packetTooLong;
+    clearBuffer();
+    packetTooLong = too_long;
+
+    lineRescan = true;
+    for (CommandPos i = 0; i < size; i++)
+        addChar(buffer[i]);
+    lineRescan = false;
+}
+#endif
+
+// Check the address at the end of the @addr prefix. Returns false and skips
+// the rest of the line if it is not for this device
+bool CommandParser::endAddress()
+{
+    // Must be this device or the broadcast address
+    if (lineAddressDigits == 0 ||
+        (lineAddress != rs485Address && lineAddress != 0xff))
+    {
+        lineState = LINE_SKIP;
+        return false;
+    }
+
+    // The command starts after any spaces
+    lineState = LINE_AFTER_ADDRESS;
+    readPos = writePos;
+    return true;
 }
 
+void CommandParser::echo(char c)
+{
+#if COMMAND_INTERACTIVE
+    if (interactive && !batch && !lineRescan)
+        serial.write(c);
+#else
+    (void)c;
+#endif
+}
+
+#if COMMAND_CRC
+// Add a character of the command to the CRC or to the expected value once
+// the $ has been seen
+void CommandParser::lineCRCChar(char c)
+{
+    if (c == '$')
+        lineHasCRC = true;
+    else if (lineHasCRC)
+        lineExpectedCRC = (lineExpectedCRC << 4) | convertNimble(c);
+    else
+        lineCRC = _crc_ccitt_update(lineCRC, c);
+}
+#endif
+
 // Wrapper for serial.available.
 // This is used by a client to turn on an LED when input is available
 bool CommandParser::inputAvailable()
@@ -164,7 +501,7 @@ bool CommandParser::inputAvailable()
 const Command * CommandParser::getCommand()
 {
     const Command *matching_cmd = 0;
-    uint8_t match_length = 0;
+    CommandPos match_length = 0;
 
     for (uint8_t cmd_num = 0; true; cmd_num++)
     {
@@ -175,11 +512,13 @@ const Command * CommandParser::getCommand()
 	if (cmd_p == 0)
             break;
 
-	for (int8_t i = 0; i <= writePos - readPos; i++)
+	for (CommandPos i = 0; i <= writePos - readPos; i++)
 	{
 	    char cmd_c = pgm_read_byte(cmd_p + i);
-	    char buf_c = buffer[i + readPos];
-	    if (cmd_c == '\0' || buf_c == ' ' || i == (writePos - readPos))
+	    // The end of the line ends the word. A full line has no byte
+	    // after it in the buffer
+	    char buf_c = i == (writePos - readPos) ? ' ' : buffer[i + readPos];
+	    if (cmd_c == '\0' || buf_c == ' ')
 	    {
                 // If it is a longer match then replace
                 if (i > match_length)
@@ -205,79 +544,56 @@ const Command * CommandParser::getCommand()
 
 void CommandParser::processPacket()
 {
+    SWD_PROFILE_SCOPE(PROFILE_PROCESS_PACKET);
+
 #if COMMAND_INTERACTIVE
     // After each command is processed possibly output a prompt
     needsPrompt = true;
 #endif
 
-    if (writePos == 0)
-	return;
+    // The line may end straight after the address
+    if (lineState == LINE_ADDRESS)
+        endAddress();
 
-    // Ignore lines that start with * as they are just responses from other devices on the RS485 bus
-    if (buffer[0] == '*')
-    {
-	clearBuffer();
-	return;
-    }
+#if COMMAND_STATS
+    if (lineState == LINE_NO_ADDRESS)
+        statsMissingAddress++;
+#endif
 
-    // If the first part of the packet is a hex digit then this an
-    // a device address. Strip this off and compare with the address
-    // of this device.
-    if (buffer[0] == '@')
+    // Empty lines and lines for other devices or from them
+    if (lineState != LINE_BODY && lineState != LINE_AFTER_ADDRESS)
     {
-	readPos++;
-	int command_address;
-	// Check supplied address is equal to actual address or the broadcast
-	// address
-	if (!parseHex(&command_address) ||
-	    (command_address != rs485Address && command_address != 0xff))
-	{
-	    clearBuffer();
-	    return;
-	}
-
-	skipSpace();
+        clearBuffer();
+        return;
     }
-    else if (rs485Address != 0)
+
+    if (packetTooLong)
     {
-	// If the command parser has an address and no address is supplied in
-	// the command then return. This stops multiple devices fighting when
-	// there are bus errors
+        print(PSTR("Packet too long"));
+        printLine();
 
 #if COMMAND_STATS
-        statsMissingAddress++;
+        statsMaxPacketLength++;
 #endif
 
-	clearBuffer();
-	return;
+        clearBuffer();
+        doStatus(false);
+        return;
     }
 
 #if COMMAND_CRC
-    // Scan the packet buffer looking for the expected CRC and
-    // also calculating the CRC along the way.
+    // Worked out as the line arrived
     // NOTE: Only the device that is addressed checks the CRC values
-    bool has_crc = false;
-    uint16_t expected_crc = 0;
     crc = CRC_INITIAL;
     addCRC = false;
-    for (int8_t i = 0; i < writePos - readPos; i++)
-    {
-        char c = buffer[i + readPos];
-        if (c == '$')
-            has_crc = true;
-        else if (has_crc)
-            expected_crc = (expected_crc<<4) | convertNimble(c);
-        else
-            crc = _crc_ccitt_update(crc, c);
-    }
-    if (has_crc)
+    if (lineHasCRC)
     {
-        if (expected_crc != crc)
+        if (lineExpectedCRC != lineCRC)
         {
             // FIXME Just for testing.
             print(PSTR("CRC mismatch"));
-            printVarHex(PSTR("calculated"), crc);
-            printVarHex(PSTR("expected"), expected_crc);
+            printVarHex(PSTR("calculated"), lineCRC);
+            printVarHex(PSTR("expected"), lineExpectedCRC);
 
 #if COMMAND_STATS
             statsCRCMismatch++;
@@ -290,17 +606,22 @@ void CommandParser::processPacket()
             return;
         }
 
-        crc = CRC_INITIAL;
         addCRC = true;
     }
-
 #endif
 
+    runCommands(0, true);
+}
+
+// Run the commands on the line from readPos. If cmd is set it is run first
+// instead of being looked up
+void CommandParser::runCommands(const Command *cmd, bool is_ok)
+{
     // Support chaining of commands together on the same line to save bandwidth
-    bool is_ok = true;
     while(true)
     {
-        const Command *cmd = getCommand();
+        if (cmd == 0)
+            cmd = getCommand();
         if (cmd == 0)
         {
             print(PSTR("Not valid command"));
@@ -315,15 +636,18 @@ void CommandParser::processPacket()
         }
 
         bool res = processCommand(cmd);
-        is_ok &= res;
 
-#if COMMAND_STATS
-        if (res)
-            statsCommandOK++;
-        else
-            statsCommandError++;
+#if COMMAND_SUSPEND
+        // Carry on from here in the next poll
+        if (suspended != 0)
+        {
+            chainOK = is_ok;
+            return;
+        }
 #endif
 
+        is_ok &= res;
+
         // Fail on first error
         if (!is_ok)
             break;
@@ -333,6 +657,7 @@ void CommandParser::processPacket()
         {
             readPos++;
             skipSpace();
+            cmd = 0;
         }
         else
             break;
@@ -342,18 +667,279 @@ void CommandParser::processPacket()
     doStatus(is_ok);
 }
 
+#if COMMAND_BINARY
+// Decode a COBS encoded frame in place returning the decoded length or
+// zero if the encoding is not valid
+static CommandPos cobsDecode(char *buf, CommandPos len)
+{
+    CommandPos in = 0;
+    CommandPos out = 0;
+    while (in < len)
+    {
+        uint8_t code = buf[in++];
+        if (code == 0 || code - 1 > len - in)
+            return 0;
+
+        for (uint8_t i = 1; i < code; i++)
+            buf[out++] = buf[in++];
+
+        if (code != 0xff && in < len)
+            buf[out++] = 0;
+    }
+
+    return out;
+}
+
+void CommandParser::processFrame()
+{
+    CommandPos len = cobsDecode(buffer, writePos);
+    if (packetTooLong || len < 4)
+    {
+#if COMMAND_STATS
+        if (packetTooLong)
+            statsMaxPacketLength++;
+        else
+            statsIllegalCharacter++;
+#endif
+
+        clearBuffer();
+        binaryFrame = false;
+        return;
+    }
+
+    // Frame is address, command id, arguments then the CRC16 of all of
+    // these in little endian order
+    uint8_t address = buffer[0];
+    uint8_t cmd_num = buffer[1];
+    writePos = len - 2;
+
+    if (address != rs485Address && address != 0xff)
+    {
+        clearBuffer();
+        binaryFrame = false;
+        return;
+    }
+
+    uint16_t expected_crc = (uint8_t)buffer[len - 2] |
+        ((uint16_t)(uint8_t)buffer[len - 1] << 8);
+
+    // Start the response frame
+    grabOutput();
+    response[0] = 0;
+    response[BINARY_CODE_POS + 1] = rs485Address;
+    response[BINARY_CODE_POS + 2] = cmd_num;
+    responsePos = BINARY_HEADER;
+
+    if (crcUpdateBlock(CRC_INITIAL, buffer, writePos) != expected_crc)
+    {
+#if COMMAND_STATS
+        statsCRCMismatch++;
+#endif
+
+        clearBuffer();
+        doStatus(false);
+        return;
+    }
+
+    // Look up the command by its position in the table
+    const Command *cmd = 0;
+    for (uint8_t i = 0; pgm_read_ptr(&commands[i].name) != 0; i++)
+    {
+        if (i == cmd_num)
+        {
+            cmd = &commands[i];
+            break;
+        }
+    }
+
+    bool res = false;
+    if (cmd == 0)
+    {
+#if COMMAND_STATS
+        statsInvalidCommand++;
+#endif
+    }
+    else
+    {
+        readPos = 2;
+        res = processCommand(cmd);
+
+#if COMMAND_SUSPEND
+        if (suspended != 0)
+            return;
+#endif
+    }
+
+    clearBuffer();
+    doStatus(res);
+}
+
+// COBS encode the response buffer in place with the status and CRC added
+// and write out as a single frame
+void CommandParser::sendFrame(uint8_t status)
+{
+    uint8_t cmd_num = response[BINARY_CODE_POS + 2];
+    response[BINARY_CODE_POS + 3] = status;
+
+    uint16_t frame_crc = crcUpdateBlock(CRC_INITIAL,
+                                        response + BINARY_CODE_POS + 1,
+                                        responsePos - BINARY_CODE_POS - 1);
+    response[responsePos++] = frame_crc & 0xff;
+    response[responsePos++] = frame_crc >> 8;
+
+    // Frames are shorter than 254 bytes so each zero can be replaced by
+    // the distance to the next zero without moving any data
+    uint8_t next = responsePos;
+    for (uint8_t i = responsePos - 1; i > BINARY_CODE_POS; i--)
+    {
+        if (response[i] == 0)
+        {
+            response[i] = next - i;
+            next = i;
+        }
+    }
+    response[BINARY_CODE_POS] = next - BINARY_CODE_POS;
+    response[responsePos++] = 0;
+
+    serial.write((const uint8_t *)response, responsePos);
+
+    // Restore the header for any continuation frame
+    response[BINARY_CODE_POS + 1] = rs485Address;
+    response[BINARY_CODE_POS + 2] = cmd_num;
+    responsePos = BINARY_HEADER;
+}
+
+void CommandParser::putBinary(const void *data, uint8_t size)
+{
+    // Values are sent in the little endian order of the targets
+    const char *p = (const char *)data;
+    while (size-- > 0)
+        putRaw(*p++);
+}
+
+bool CommandParser::getBinary(void *data, uint8_t size)
+{
+    if (writePos - readPos < size)
+        return false;
+
+    memcpy(data, buffer + readPos, size);
+    readPos += size;
+    return true;
+}
+
+bool CommandParser::getBinaryString(char *str, uint8_t max_length)
+{
+    // Strings are NUL terminated or run to the end of the frame
+    if (readPos >= writePos)
+        return false;
+
+    uint8_t p = 0;
+    while (readPos < writePos)
+    {
+        char c = buffer[readPos++];
+        if (c == '\0')
+            break;
+
+        if (p < max_length)
+            str[p++] = c;
+    }
+
+    str[p] = '\0';
+    return true;
+}
+#endif
+
 bool CommandParser::processCommand(const Command *c)
 {
     // Need to read the callback from program memory
     CommandCallbackFunction ccf =
         (CommandCallbackFunction)pgm_read_ptr(&c->callback);
 
+#if COMMAND_SUSPEND
+    // A resumed command parses its arguments again from here
+    resumePos = readPos;
+#endif
+
     // Call the callback
-    return ccf(this);
+    bool res = ccf(this);
+
+#if COMMAND_SUSPEND
+    if (suspendRequested)
+    {
+        suspendRequested = false;
+        suspended = c;
+        return true;
+    }
+
+    suspended = 0;
+    resumeState = 0;
+#endif
+
+#if COMMAND_STATS
+    if (res)
+        statsCommandOK++;
+    else
+        statsCommandError++;
+#endif
+
+    return res;
+}
+
+#if COMMAND_SUSPEND
+void CommandParser::suspend(unsigned long state)
+{
+    suspendRequested = true;
+    resumeState = state;
 }
 
+// Call the suspended command again and finish the packet if it completes
+void CommandParser::resume()
+{
+    const Command *cmd = suspended;
+    readPos = resumePos;
+
+#if COMMAND_BINARY
+    if (binaryFrame)
+    {
+        bool res = processCommand(cmd);
+        if (suspended != 0)
+            return;
+
+        clearBuffer();
+        doStatus(res);
+        return;
+    }
+#endif
+
+    runCommands(cmd, chainOK);
+}
+
+void CommandParser::cancel()
+{
+    suspended = 0;
+    resumeState = 0;
+
+#if COMMAND_STATS
+    statsCommandError++;
+#endif
+
+    clearBuffer();
+    doStatus(false);
+}
+#endif
+
 void CommandParser::doStatus(bool res)
 {
+#if COMMAND_BINARY
+    if (binaryFrame)
+    {
+        sendFrame(res ? BINARY_OK : BINARY_ERROR);
+        responsePos = 0;
+        binaryFrame = false;
+        return;
+    }
+#endif
+
     // The OK and ERROR responses are always output as the last part of a packet
     if (res)
 	print(PSTR("OK\n"));
@@ -364,6 +950,11 @@ void CommandParser::doStatus(bool res)
 // Parse a byte
 bool CommandParser::parseByte(uint8_t *b)
 {
+#if COMMAND_BINARY
+    if (binaryFrame)
+        return getBinary(b, 1);
+#endif
+
     skipSpace();
 
     uint8_t val = 0;
@@ -395,6 +986,18 @@ bool CommandParser::parseByte(uint8_t *b)
 // Parse an integer
 bool CommandParser::parseInt(int *i)
 {
+#if COMMAND_BINARY
+    if (binaryFrame)
+    {
+        int32_t v;
+        if (!getBinary(&v, sizeof(v)))
+            return false;
+
+        *i = v;
+        return true;
+    }
+#endif
+
     skipSpace();
 
     int val = 0;
@@ -431,6 +1034,18 @@ bool CommandParser::parseInt(int *i)
 // Parse a long integer
 bool CommandParser::parseLong(long *i)
 {
+#if COMMAND_BINARY
+    if (binaryFrame)
+    {
+        int32_t v;
+        if (!getBinary(&v, sizeof(v)))
+            return false;
+
+        *i = v;
+        return true;
+    }
+#endif
+
     skipSpace();
 
     long val = 0;
@@ -479,6 +1094,18 @@ int CommandParser::convertNimble(char c)
 
 bool CommandParser::parseHex(int *i)
 {
+#if COMMAND_BINARY
+    if (binaryFrame)
+    {
+        int32_t v;
+        if (!getBinary(&v, sizeof(v)))
+            return false;
+
+        *i = v;
+        return true;
+    }
+#endif
+
     skipSpace();
 
     int val = 0;
@@ -511,6 +1138,11 @@ bool CommandParser::parseHex(int *i)
 // Parse a string
 bool CommandParser::parseString(char *str, uint8_t max_length)
 {
+#if COMMAND_BINARY
+    if (binaryFrame)
+        return getBinaryString(str, max_length);
+#endif
+
     skipSpace();
 
     uint8_t p;
@@ -520,8 +1152,14 @@ bool CommandParser::parseString(char *str, uint8_t max_length)
 	    break;
 
 	char c = buffer[readPos++];
-	if (c == ' ' || c == ';')
+	if (c == ' ')
 	    break;
+        else if (c == ';')
+        {
+            // Leave the separator for the next chained command
+            readPos--;
+            break;
+        }
 
 	str[p] = c;
     }
@@ -538,6 +1176,11 @@ bool CommandParser::parseString(char *str, uint8_t max_length)
 // Parse the rest of the line including any spaces
 bool CommandParser::parseRest(char *str, uint8_t max_length)
 {
+#if COMMAND_BINARY
+    if (binaryFrame)
+        return getBinaryString(str, max_length);
+#endif
+
     skipSpace();
 
     uint8_t p;
@@ -548,7 +1191,10 @@ bool CommandParser::parseRest(char *str, uint8_t max_length)
 
 	char c = buffer[readPos++];
         if (c == ';')
+        {
+            readPos--;
             break;
+        }
 
 	str[p] = c;
     }
@@ -566,6 +1212,11 @@ bool CommandParser::parseRest(char *str, uint8_t max_length)
 #if COMMAND_FLOAT
 bool CommandParser::parseFloat(float *f)
 {
+#if COMMAND_BINARY
+    if (binaryFrame)
+        return getBinary(f, sizeof(*f));
+#endif
+
     skipSpace();
 
     bool negative_mantissa = false;
@@ -579,6 +1230,7 @@ bool CommandParser::parseFloat(float *f)
         IN_EXPONENT
     };
     enum Stage stage = IN_INT;
+    uint8_t digits = 0;
 
     while (readPos < writePos)
     {
@@ -588,11 +1240,15 @@ bool CommandParser::parseFloat(float *f)
         {
             int d = c - '0';
             if (stage == IN_INT)
+            {
                 mantissa = mantissa*10.0f + d;
+                digits++;
+            }
             else if (stage == IN_FRACT)
             {
                 fract_part /= 10;
                 mantissa += d * fract_part;
+                digits++;
             }
             else if (stage == IN_EXPONENT)
                 exponent = exponent*10 + d;
@@ -624,8 +1280,9 @@ bool CommandParser::parseFloat(float *f)
         }
         else if (c == ',')
             continue;
-        else if (c == ' ')
+        else if (c == ' ' || c == ';' || c == '$')
         {
+            // Leave the separator for the next chained command or the CRC
             readPos--;
             break;
         }
@@ -633,6 +1290,9 @@ bool CommandParser::parseFloat(float *f)
             return false;
     }
 
+    if (digits == 0)
+        return false;
+
     if (negative_mantissa)
         mantissa = -mantissa;
 
@@ -652,6 +1312,20 @@ bool CommandParser::parseFloat(float *f)
 }
 #endif
 
+bool CommandParser::endOfArguments()
+{
+#if COMMAND_BINARY
+    if (binaryFrame)
+        return readPos >= writePos;
+#endif
+
+    skipSpace();
+
+    // Another chained command or the CRC may follow
+    return readPos >= writePos || buffer[readPos] == ';' ||
+        buffer[readPos] == '$';
+}
+
 void CommandParser::skipSpace()
 {
     while (readPos < writePos && buffer[readPos] == ' ')
@@ -660,7 +1334,21 @@ void CommandParser::skipSpace()
 
 void CommandParser::putChar(char c)
 {
-    grabOutput();
+    SWD_PROFILE_SCOPE(PROFILE_PUT_CHAR);
+
+#if COMMAND_BINARY
+    // Text in a binary response is sent as is
+    if (binaryFrame)
+    {
+        putRaw(c);
+        return;
+    }
+#endif
+
+    // Only need to check the RS485 direction when starting a new block of
+    // output as nothing is sent to the stream until the block is flushed
+    if (responsePos == 0)
+        grabOutput();
     if (needResponsePrefix)
         sendResponsePrefix();
 
@@ -669,27 +1357,96 @@ void CommandParser::putChar(char c)
 #if COMMAND_CRC
         if (addCRC)
         {
-            serial.print('$');
-            serial.print(crc, HEX);
+            // Make sure the whole trailer fits so it is not included
+            // in the CRC of the next line
+            updateCRC();
+            if (responsePos + 7 > COMMAND_RESPONSE_BUFFER)
+                flush();
+
+            putRaw('$');
+            putRawHex(crc);
             crc = CRC_INITIAL;
         }
 #endif
 
-        serial.print('\r');
-        serial.print('\n');
+        putRaw('\r');
+        putRaw('\n');
+#if COMMAND_CRC
+        crcPos = responsePos;
+#endif
+        // In batch mode responses are sent back to back when the buffer
+        // fills or the poll completes
+        if (!batch)
+            flush();
 
         // Add a prefix to the next line as we run around the loop
         needResponsePrefix = true;
     }
     else
+        putRaw(c);
+}
+
+void CommandParser::putRaw(char c)
+{
+    if (responsePos >= COMMAND_RESPONSE_BUFFER)
+        flush();
+
+    response[responsePos++] = c;
+}
+
+void CommandParser::putRawHex(uint16_t v)
+{
+    // Same format as Print::print(v, HEX) so no leading zeros
+    bool leading = true;
+    for (int8_t shift = 12; shift >= 0; shift -= 4)
     {
+        uint8_t n = (v >> shift) & 0x0f;
+        if (n == 0 && leading && shift != 0)
+            continue;
+
+        leading = false;
+        putRaw(n < 10 ? '0' + n : 'A' + n - 10);
+    }
+}
+
 #if COMMAND_CRC
-        if (addCRC)
-            crc = _crc_ccitt_update(crc, c);
+// Add any output since the last update to the running CRC
+void CommandParser::updateCRC()
+{
+    if (addCRC)
+        crc = crcUpdateBlock(crc, response + crcPos, responsePos - crcPos);
+
+    crcPos = responsePos;
+}
 #endif
 
-        serial.print(c);
+void CommandParser::flush()
+{
+#if COMMAND_BINARY
+    // Send what is there so far and continue the response in another frame
+    if (binaryFrame)
+    {
+        if (responsePos > BINARY_HEADER)
+            sendFrame(BINARY_CONTINUE);
+        return;
     }
+#endif
+
+    if (responsePos == 0)
+        return;
+
+#if COMMAND_CRC
+    updateCRC();
+    crcPos = 0;
+#endif
+
+    serial.write((const uint8_t *)response, responsePos);
+    responsePos = 0;
+}
+
+int CommandParser::availableForWrite()
+{
+    return serial.availableForWrite() - responsePos;
 }
 
 void CommandParser::print(const char * PROGMEM str)
@@ -718,9 +1475,13 @@ void CommandParser::sendResponsePrefix()
 
     if (rs485Address != 0)
     {
-        serial.print('*');
-        serial.print(rs485Address, HEX);
-        serial.print(' ');
+        putRaw('*');
+        putRawHex(rs485Address);
+        putRaw(' ');
+#if COMMAND_CRC
+        // The prefix is not part of the checksum
+        crcPos = responsePos;
+#endif
     }
 }
 
@@ -738,6 +1499,89 @@ void CommandParser::putByteHex(uint8_t b)
     putNibble(b & 0x0f);
 }
 
+// Two character decimal strings for 00 to 99 so base 10 conversion only
+// needs one division by 100 for each pair of digits
+static const char digitPairs[201] PROGMEM =
+    "0001020304050607080910111213141516171819"
+    "2021222324252627282930313233343536373839"
+    "4041424344454647484950515253545556575859"
+    "6061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+// Set when the core has no 32x32->64 bit multiply instruction. A 64 bit
+// multiply there is a library call so divide100() builds the high word from
+// 16 bit products instead
+#ifndef COMMAND_NARROW_MULTIPLY
+#if defined(__ARM_ARCH_6M__) || defined(__AVR__)
+#define COMMAND_NARROW_MULTIPLY 1
+#else
+#define COMMAND_NARROW_MULTIPLY 0
+#endif
+#endif
+
+// i/100 using a multiply by the reciprocal. Exact for all 32 bit values
+static inline uint32_t divide100(uint32_t i)
+{
+#if COMMAND_NARROW_MULTIPLY
+    // High word of i * 0x51eb851f. Four MULS and no carries out of 32 bits
+    uint32_t lo = i & 0xffff;
+    uint32_t hi = i >> 16;
+    uint32_t mid1 = hi * 0x851fu + ((lo * 0x851fu) >> 16);
+    uint32_t mid2 = lo * 0x51ebu + (mid1 & 0xffff);
+    return (hi * 0x51ebu + (mid1 >> 16) + (mid2 >> 16)) >> 5;
+#else
+    return ((uint64_t)i * 0x51eb851fu) >> 37;
+#endif
+}
+
+// Convert a number to digit characters, least significant first. Bases 2,
+// 8, 10 and 16 do not use any division instructions. Returns the number of
+// digits
+static uint8_t toDigits(uint32_t i, uint8_t base, char *digits)
+{
+    uint8_t n = 0;
+
+    if (base == 10)
+    {
+        while (i >= 100)
+        {
+            uint32_t q = divide100(i);
+            uint8_t r = i - q * 100;
+            digits[n++] = pgm_read_byte(&digitPairs[2*r + 1]);
+            digits[n++] = pgm_read_byte(&digitPairs[2*r]);
+            i = q;
+        }
+
+        digits[n++] = pgm_read_byte(&digitPairs[2*i + 1]);
+        if (i >= 10)
+            digits[n++] = pgm_read_byte(&digitPairs[2*i]);
+    }
+    else if (base == 2 || base == 8 || base == 16)
+    {
+        uint8_t shift = (base == 16) ? 4 : (base == 8) ? 3 : 1;
+        uint8_t mask = base - 1;
+        do
+        {
+            uint8_t d = i & mask;
+            digits[n++] = d < 10 ? '0' + d : 'A' + d - 10;
+            i >>= shift;
+        }
+        while (i != 0);
+    }
+    else
+    {
+        do
+        {
+            uint8_t d = i % base;
+            digits[n++] = d < 10 ? '0' + d : 'A' + d - 10;
+            i /= base;
+        }
+        while (i != 0);
+    }
+
+    return n;
+}
+
 void CommandParser::putNumber(unsigned long i,
                               int8_t width,
                               bool leading_zeros,
@@ -745,6 +1589,12 @@ void CommandParser::putNumber(unsigned long i,
                               uint8_t num_factors,
                               unsigned long max_factor)
 {
+    // The digits are converted up front so max_factor is no longer needed
+    (void)max_factor;
+
+    char digits[32];
+    uint8_t num_digits = toDigits(i, base, digits);
+
 #if COMMAND_ADVANCED_FORMAT
     // Padding and truncation for right justification
     if (width > 0)
@@ -759,33 +1609,21 @@ void CommandParser::putNumber(unsigned long i,
                 putChar(' ');
         }
 
-        while (num_factors > width && i < max_factor)
-        {
-            num_factors--;
-            max_factor /= base;
-        }
+        // Only need enough positions for the width or the actual digits
+        num_factors = width;
+        if (num_digits > num_factors)
+            num_factors = num_digits;
     }
 #else
     width = width;
-    num_factors = num_factors;
 #endif
 
-    unsigned long f = max_factor;
-    while (true)
+    for (uint8_t pos = num_factors; pos > 0; pos--)
     {
-        if (f == 0)
-            break;
-
-        unsigned int d = i/f;
-
-        if (d != 0 || leading_zeros || f == 1)
+        if (pos <= num_digits || leading_zeros)
         {
-            putNibble(d);
-            i -= d*f;
-
-            // Once we have output a digit then
-            // all other parts must have a zero
-            leading_zeros = true;
+            // Positions above the most significant digit are zero
+            putChar(pos <= num_digits ? digits[pos - 1] : '0');
 
 #if COMMAND_ADVANCED_FORMAT
             if (width < 0)
@@ -796,8 +1634,6 @@ void CommandParser::putNumber(unsigned long i,
         else if (width > 0)
             putChar(' ');
 #endif
-
-        f /= base;
     }
 
 #if COMMAND_ADVANCED_FORMAT
@@ -814,6 +1650,15 @@ void CommandParser::printHex(unsigned long var,
                              int8_t width,
                              bool leading_zeros)
 {
+#if COMMAND_BINARY
+    if (binaryFrame)
+    {
+        uint32_t v = var;
+        putBinary(&v, sizeof(v));
+        return;
+    }
+#endif
+
     print(PSTR("0x"));
     putNumber(var, width, leading_zeros, 16, 8, 0x10000000);
 }
@@ -822,6 +1667,15 @@ void CommandParser::printDecimal(long var,
                                  int8_t width,
                                  bool leading_zeros)
 {
+#if COMMAND_BINARY
+    if (binaryFrame)
+    {
+        int32_t v = var;
+        putBinary(&v, sizeof(v));
+        return;
+    }
+#endif
+
     // Output the sign
     if (var < 0)
     {
@@ -841,12 +1695,29 @@ void CommandParser::printDecimal(long var,
 void CommandParser::printBinary(unsigned long var,
                                 int8_t width)
 {
+#if COMMAND_BINARY
+    if (binaryFrame)
+    {
+        uint32_t v = var;
+        putBinary(&v, sizeof(v));
+        return;
+    }
+#endif
+
     putNumber(var, width, true, 2, 32, 0x80000000);
 }
 
 #if COMMAND_FLOAT
 void CommandParser::printFloat(float var, int8_t decimal_places)
 {
+#if COMMAND_BINARY
+    if (binaryFrame)
+    {
+        putBinary(&var, sizeof(var));
+        return;
+    }
+#endif
+
     if (var < 0)
     {
         putChar('-');
@@ -871,6 +1742,15 @@ void CommandParser::printFloat(float var, int8_t decimal_places)
 
 void CommandParser::printVarHex(const PROGMEM char *str, int var)
 {
+#if COMMAND_BINARY
+    // Binary responses only contain the value
+    if (binaryFrame)
+    {
+        printHex(var);
+        return;
+    }
+#endif
+
     // The print does the grabOutput() and prefix handling
     print(str);
     putChar('=');
@@ -880,6 +1760,15 @@ void CommandParser::printVarHex(const PROGMEM char *str, int var)
 
 void CommandParser::printVar(const PROGMEM char *str, int var)
 {
+#if COMMAND_BINARY
+    // Binary responses only contain the value
+    if (binaryFrame)
+    {
+        printDecimal(var);
+        return;
+    }
+#endif
+
     // The print does the grabOutput() and prefix handling
     print(str);
     putChar('=');
@@ -889,6 +1778,15 @@ void CommandParser::printVar(const PROGMEM char *str, int var)
 
 void CommandParser::printVar(const PROGMEM char *str, unsigned int var)
 {
+#if COMMAND_BINARY
+    // Binary responses only contain the value
+    if (binaryFrame)
+    {
+        printDecimal(var);
+        return;
+    }
+#endif
+
     // The print does the grabOutput() and prefix handling
     print(str);
     putChar('=');
@@ -898,6 +1796,15 @@ void CommandParser::printVar(const PROGMEM char *str, unsigned int var)
 
 void CommandParser::printVar(const PROGMEM char *str, long var)
 {
+#if COMMAND_BINARY
+    // Binary responses only contain the value
+    if (binaryFrame)
+    {
+        printDecimal(var);
+        return;
+    }
+#endif
+
     // The print does the grabOutput() and prefix handling
     print(str);
     putChar('=');
@@ -907,6 +1814,15 @@ void CommandParser::printVar(const PROGMEM char *str, long var)
 
 void CommandParser::printVar(const PROGMEM char *str, unsigned long var)
 {
+#if COMMAND_BINARY
+    // Binary responses only contain the value
+    if (binaryFrame)
+    {
+        printDecimal(var);
+        return;
+    }
+#endif
+
     // The print does the grabOutput() and prefix handling
     print(str);
     putChar('=');
@@ -916,6 +1832,17 @@ void CommandParser::printVar(const PROGMEM char *str, unsigned long var)
 
 void CommandParser::printVar(const PROGMEM char *str, const char *var)
 {
+#if COMMAND_BINARY
+    // Binary responses only contain the NUL terminated string
+    if (binaryFrame)
+    {
+        do
+            putRaw(*var);
+        while (*var++ != '\0');
+        return;
+    }
+#endif
+
     // The print does the grabOutput() and prefix handling
     print(str);
     putChar('=');
@@ -933,6 +1860,15 @@ void CommandParser::printVar(const PROGMEM char *str, const char *var)
 #if COMMAND_FLOAT
 void CommandParser::printVar(const char * PROGMEM str, float var)
 {
+#if COMMAND_BINARY
+    // Binary responses only contain the value
+    if (binaryFrame)
+    {
+        printFloat(var);
+        return;
+    }
+#endif
+
     print(str);
     putChar('=');
     printFloat(var);
@@ -993,9 +1929,11 @@ void CommandParser::grabOutput()
 
 void CommandParser::releaseOutput()
 {
+    flush();
+
 #if COMMAND_INTERACTIVE
     // Show the prompt if not interactive
-    if (interactive && needsPrompt)
+    if (interactive && needsPrompt && !batch)
     {
         serial.write("> ");
         needsPrompt = false;
@@ -1058,6 +1996,30 @@ void CommandParser::showStats()
 
 #endif
 
+#if SWD_PROFILE
+// Output the cycle counts of the instrumented functions
+void CommandParser::showProfile()
+{
+    for (uint8_t i = 0; i < swdProfile.count; i++)
+    {
+        const SWDProfileEntry &e = swdProfile.entries[i];
+        uint32_t calls = e.calls;
+        uint32_t avg = calls > 0 ? e.total / calls : 0;
+
+        print(e.name);
+        print(PSTR(" calls="));
+        putNumber(calls, 0, false, 10, 10, 1000000000);
+        print(PSTR(" min="));
+        putNumber(e.min, 0, false, 10, 10, 1000000000);
+        print(PSTR(" avg="));
+        putNumber(avg, 0, false, 10, 10, 1000000000);
+        print(PSTR(" max="));
+        putNumber(e.max, 0, false, 10, 10, 1000000000);
+        printLine();
+    }
+}
+#endif
+
 #if COMMAND_INTERACTIVE
 void CommandParser::setInteractive(bool b)
 {
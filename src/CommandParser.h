@@ -16,6 +16,55 @@
  * Where: @addr is the optional RS485 address
  *        $cccc is an optional CRC16 checksum
  *
+ * Lines are worked through as they arrive. A line for another address is
+ * dropped as soon as the @addr prefix ends so it is never buffered, and the
+ * CRC is kept up to date with each character so the end of the line only
+ * has to check it and dispatch the command. In interactive mode the whole
+ * line is kept so backspace can edit any of it, including the address.
+ *
+ * A Ctrl-B character switches to batch mode where input is not echoed and no
+ * prompts are output so a host can send many commands back to back. Ctrl-C
+ * returns to normal mode.
+ *
+ * Binary Protocol
+ * When COMMAND_BINARY is built in and enabled with setBinary() a NUL
+ * character at the start of a packet starts a COBS encoded frame that is
+ * ended by the next NUL. Once decoded a frame contains:
+ * addr cmd {args}* crc16
+ *
+ * Where: addr is the RS485 address, 0 if none or 0xff for broadcast
+ *        cmd is the position of the command in the command table
+ *        args are packed little endian. Bytes are 1 byte, int, long, hex
+ *        and float arguments are 4 bytes and strings are NUL terminated
+ *        crc16 is the CRC16 of the preceeding bytes, low byte first
+ *
+ * Responses are framed the same way as addr cmd status {data}* crc16 where
+ * the status is one of BINARY_OK, BINARY_ERROR or BINARY_CONTINUE when the
+ * response continues in another frame. printVar() and the number print
+ * functions only output the packed value and print() outputs the raw text.
+ *
+ * Long Running Commands
+ * When COMMAND_SUSPEND is built in a command can call suspend() and return
+ * to be called again from the next poll() with the same arguments. This
+ * lets a command pace a large response to what the host has read using
+ * availableForWrite() or wait on hardware without holding up loop(). No
+ * more input is read until the command completes apart from a Ctrl-C which
+ * cancels it. For example:
+ *
+ * bool dump_cmd(CommandParser *c, Hex addr, int len)
+ * {
+ *     for (unsigned long i = c->getResumeState(); i < len; i += 16)
+ *     {
+ *         if (c->availableForWrite() < 70)
+ *         {
+ *             c->suspend(i);
+ *             return true;
+ *         }
+ *         ...
+ *     }
+ *     return true;
+ * }
+ *
  */
 #ifndef COMMAND_PARSER_H
 #define COMMAND_PARSER_H
@@ -27,6 +76,8 @@
 
 #include <Arduino.h>
 
+#include "SWDProfile.h"
+
 #ifndef COMMAND_STATS
 #define COMMAND_STATS 1
 #endif
@@ -42,9 +93,41 @@
 #ifndef COMMAND_FLOAT
 #define COMMAND_FLOAT
 #endif
+#ifndef COMMAND_BINARY
+#define COMMAND_BINARY 0
+#endif
+#ifndef COMMAND_SUSPEND
+#define COMMAND_SUSPEND 1
+#endif
+#if COMMAND_BINARY && !COMMAND_CRC
+#error COMMAND_BINARY requires COMMAND_CRC
+#endif
+// Longest command line accepted. Longer lines are rejected with an error
+#ifndef COMMAND_MAX_PACKET
+#define COMMAND_MAX_PACKET 64
+#endif
+// Size of the buffer used to assemble response lines before they are
+// written to the stream. Longer lines are written in several blocks
+#ifndef COMMAND_RESPONSE_BUFFER
+#define COMMAND_RESPONSE_BUFFER 80
+#endif
+#if COMMAND_BINARY && COMMAND_RESPONSE_BUFFER > 240
+#error COMMAND_RESPONSE_BUFFER must fit in a single COBS block
+#endif
+
+// Status of binary response frames
+#define BINARY_OK 0
+#define BINARY_ERROR 1
+#define BINARY_CONTINUE 2
 
 class CommandParser;
 
+#if COMMAND_MAX_PACKET > 255
+typedef uint16_t CommandPos;
+#else
+typedef uint8_t CommandPos;
+#endif
+
 typedef bool (*CommandCallbackFunction)(CommandParser *c);
 
 struct Command
@@ -68,7 +151,8 @@ public:
 
     // Poll the serial port reading characters as they become available
     // When a full packet has arrive the command will be dispatched off to
-    // the correct handler
+    // the correct handler. While a command is suspended this must be called
+    // even if no input is available so the command can continue
     void poll();
 
     // Wrapper for Serial.available. This is used to be a client to
@@ -97,12 +181,16 @@ public:
     bool parseFloat(float *f);
 #endif
 
+    // Check all of the arguments to the current command have been parsed
+    bool endOfArguments();
+
     // Output the help information
     void showHelp();
 
     // Used by commands to generate the response
     // Note: These should always be used instead of Serial.print to ensure
     // the RS485 bus is captured and to calculate the optional CRC16 checksums
+    // Output is buffered and written to the stream at the end of each line
     void putChar(char c);
     void print(const char * PROGMEM str);
     void putNibble(uint8_t n);
@@ -112,6 +200,7 @@ public:
     // Width of 0 means size automatically.
     // Positive width left justify
     // Negative width right justify
+    // Any base from 2 to 36 works. max_factor is not used any more
     void putNumber(unsigned long i,
                    int8_t width,
                    bool leading_zeros,
@@ -149,6 +238,22 @@ public:
     void releaseOutput();
     void clearBuffer();
 
+    // Write any partial response line to the stream
+    void flush();
+
+    // Space in the stream for more output less what is already buffered
+    int availableForWrite();
+
+#if COMMAND_SUSPEND
+    // Called by a command before it returns to be called again from the
+    // next poll() instead of completing. The return value of the command
+    // is ignored. getResumeState() returns the state on the next call and
+    // is 0 on the first call
+    void suspend(unsigned long state);
+    unsigned long getResumeState() const { return resumeState; }
+    bool isSuspended() const { return suspended != 0; }
+#endif
+
     uint8_t getRS485Address() const;
     void setRS485Address(uint8_t addr);
 
@@ -157,40 +262,118 @@ public:
     void showStats();
 #endif
 
+#if SWD_PROFILE
+    // Output the SWD_PROFILE cycle counts. See SWDProfile.h
+    void showProfile();
+#endif
+
     Stream &getStream() { return serial; }
 
 #if COMMAND_INTERACTIVE
     void setInteractive(bool b);
 #endif
 
+    // In batch mode input is not echoed, no prompts are output and the
+    // responses for all lines read in a poll are written together
+    void setBatch(bool b);
+
+#if COMMAND_BINARY
+    // Accept binary frames as well as ASCII commands
+    void setBinary(bool b);
+#endif
+
 protected:
     Stream &serial;
 
-#define MAX_PACKET 64
     const Command * PROGMEM commands;
 #if COMMAND_INTERACTIVE
     bool interactive;
     bool needsPrompt;
 #endif
     uint8_t rs485TXEN;
-    char buffer[MAX_PACKET];
-    uint8_t readPos;
-    uint8_t writePos;
+    char buffer[COMMAND_MAX_PACKET];
+    CommandPos readPos;
+    CommandPos writePos;
+    bool packetTooLong;
+    // Progress through the current line. One of the LINE_ states
+    uint8_t lineState;
+    uint8_t lineAddressDigits;
+    unsigned int lineAddress;
+#if COMMAND_INTERACTIVE
+    // Set while rescanLine() takes the buffer again so it is not echoed
+    bool lineRescan;
+#endif
+#if COMMAND_CRC
+    // CRC of the command so far and the $cccc value if there is one
+    uint16_t lineCRC;
+    uint16_t lineExpectedCRC;
+    bool lineHasCRC;
+#endif
+    bool batch;
+#if COMMAND_BINARY
+    bool binary;
+    // Set while receiving and responding to a binary frame
+    bool binaryFrame;
+#endif
     bool needResponsePrefix;
     uint8_t rs485Address;
+#if COMMAND_SUSPEND
+    // Command to call again on the next poll
+    const Command *suspended;
+    bool suspendRequested;
+    unsigned long resumeState;
+    // Start of the arguments of the suspended command
+    CommandPos resumePos;
+    // Result of the commands before it on the line
+    bool chainOK;
+#endif
 
+    void addChar(char c);
+    bool storeChar(char c);
+#if COMMAND_INTERACTIVE
+    void rescanLine();
+#endif
+    bool endAddress();
+    void echo(char c);
+#if COMMAND_CRC
+    void lineCRCChar(char c);
+#endif
     void processPacket();
+    void runCommands(const Command *cmd, bool is_ok);
     const Command *getCommand();
     bool processCommand(const Command *cmd);
+#if COMMAND_SUSPEND
+    void resume();
+    void cancel();
+#endif
     void skipSpace();
     void doStatus(bool res);
     void sendResponsePrefix();
     int convertNimble(char c);
+    void putRaw(char c);
+    void putRawHex(uint16_t v);
 
+#if COMMAND_BINARY
+    void processFrame();
+    void sendFrame(uint8_t status);
+    void putBinary(const void *data, uint8_t size);
+    bool getBinary(void *data, uint8_t size);
+    bool getBinaryString(char *str, uint8_t max_length);
+
+    // Extra space for the frame CRC and delimiter
+    char response[COMMAND_RESPONSE_BUFFER + 3];
+#else
+    char response[COMMAND_RESPONSE_BUFFER];
+#endif
+    uint8_t responsePos;
 
 #if COMMAND_CRC
     uint16_t crc;
     bool addCRC;
+    // Position in the response buffer up to which the CRC has been calculated
+    uint8_t crcPos;
+
+    void updateCRC();
 #endif
 #if COMMAND_STATS
     unsigned int statsMaxPacketLength;
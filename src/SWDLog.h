@@ -0,0 +1,35 @@
+#pragma once
+
+#include <stdint.h>
+
+// Log levels and categories for the mask word in the SWDStream and
+// SWDPrint control blocks. The host can change the mask at any time to
+// turn messages on and off without reflashing.
+//
+// A message is given a level and optionally a category and is only output
+// if all its bits are set in the mask. The levels are separate bits so the
+// host sets every level up to the one it wants.
+#define SWD_LOG_ERROR      0x01
+#define SWD_LOG_WARN       0x02
+#define SWD_LOG_INFO       0x04
+#define SWD_LOG_DEBUG      0x08
+#define SWD_LOG_TRACE      0x10
+
+#define SWD_LOG_LEVELS     0x000000ff
+#define SWD_LOG_CATEGORIES 0xffffff00
+
+// Categories 0 to 23 are for the application to assign
+#define SWD_LOG_CATEGORY(n) ((uint32_t)1 << (8 + (n)))
+
+// Mask in effect until the host changes it
+#ifndef SWD_LOG_DEFAULT
+#define SWD_LOG_DEFAULT \
+    (SWD_LOG_CATEGORIES | SWD_LOG_ERROR | SWD_LOG_WARN | SWD_LOG_INFO)
+#endif
+
+// Use as
+//   SWD_LOG(logger, SWD_LOG_DEBUG | SWD_LOG_CATEGORY(2)).println(value);
+// When the message is disabled nothing after the macro is evaluated so it
+// costs a load of the mask and a branch
+#define SWD_LOG(stream, bits) \
+    if (!(stream).logEnabled(bits)) {} else (stream)
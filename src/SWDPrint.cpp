@@ -1,10 +1,18 @@
 #include "SWDPrint.h"
 
+// For __DMB()
+#include <Arduino.h>
+
 SWDPrint::SWDPrint()
-    : magic(SWDPRINT_MAGIC),
+    : magic(0),
       outHead(0),
-      outTail(0)
+      outTail(0),
+      attached(0),
+      logMask(SWD_LOG_DEFAULT)
 {
+    // Written last as in SWDStream
+    __DMB();
+    magic = SWDPRINT_MAGIC;
 }
 
 // Print overrides
@@ -42,14 +50,8 @@ size_t SWDPrint::write(const uint8_t *buffer, size_t size)
     return i;
 }
 
+// Same as SWDStream::availableForWrite()
 int SWDPrint::availableForWrite()
 {
-#if 1
-    return sizeof(outBuffer);
-#else
-    if (outHead < outTail)
-        return outTail - outHead;
-    else
-        return sizeof(outBuffer) + outTail - outHead;
-#endif
+    return sizeof(outBuffer) - 1 - (uint8_t)(outHead - outTail);
 }
@@ -2,7 +2,11 @@
 
 #include <Stream.h>
 
-#define SWDPRINT_MAGIC 0xd5715e0c
+#include "SWDLog.h"
+
+// Changed with the layout as for SWDSERIAL_MAGIC. 0xd5715e0c was the
+// layout before logMask and 0xd5715e10 the one before attached
+#define SWDPRINT_MAGIC 0xd5715e12
 
 class SWDPrint : public Print
 {
@@ -14,6 +18,12 @@ public:
     virtual size_t write(const uint8_t *buffer, size_t size);
     virtual int availableForWrite();
 
+    // True if a message with these level and category bits should be
+    // output. See SWD_LOG()
+    bool logEnabled(uint32_t bits) const { return (logMask & bits) == bits; }
+    uint32_t getLogMask() const { return logMask; }
+    void setLogMask(uint32_t mask) { logMask = mask; }
+
 protected:
     // Implement 255 (256-1) byte circular buffer for output
     // If head==tail then the buffer is empty.
@@ -23,6 +33,10 @@ protected:
     uint8_t outHead;
     uint8_t outTail;
     uint8_t unused[2];
+    // Set by the host as in SWDStream
+    volatile uint32_t attached;
+    // Written by the host
+    volatile uint32_t logMask;
     uint8_t outBuffer[256];
 };
 
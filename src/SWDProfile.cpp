@@ -0,0 +1,34 @@
+#include "SWDProfile.h"
+
+#if SWD_PROFILE
+
+SWDProfile swdProfile;
+
+SWDProfile::SWDProfile()
+    : magic(SWDPROFILE_MAGIC),
+      count(PROFILE_POINTS)
+{
+    // The counts are left alone as instrumented code may have run during
+    // static construction
+    entries[PROFILE_STREAM_WRITE].name = "SWDStream::write";
+    entries[PROFILE_POLL].name = "CommandParser::poll";
+    entries[PROFILE_PROCESS_PACKET].name = "CommandParser::processPacket";
+    entries[PROFILE_PUT_CHAR].name = "CommandParser::putChar";
+
+    // Start the cycle counter. A debugger may have done this already
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+}
+
+void SWDProfile::clear()
+{
+    for (SWDProfileEntry &e : entries)
+    {
+        e.calls = 0;
+        e.min = 0;
+        e.max = 0;
+        e.total = 0;
+    }
+}
+
+#endif
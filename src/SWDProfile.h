@@ -0,0 +1,97 @@
+#pragma once
+
+#include <stdint.h>
+
+// Cycle counts for the console hot paths. With SWD_PROFILE set to 1 each
+// instrumented function records its calls, total and longest time in DWT
+// cycles in a table in RAM. The host finds the table by its magic number
+// and reads it without stopping the target. Times include any functions
+// called and interrupts taken. Counts from a function used in interrupts
+// and the main loop at the same time may be slightly off.
+//
+// The layout seen by the host is:
+//
+//   magic      4 bytes SWDPROFILE_MAGIC
+//   count      4 bytes number of entries
+//   entries    count times
+//     name     4 bytes pointer to a NUL terminated name
+//     calls    4 bytes
+//     min      4 bytes cycles
+//     max      4 bytes cycles
+//     total    8 bytes cycles
+#ifndef SWD_PROFILE
+#define SWD_PROFILE 0
+#endif
+
+#define SWDPROFILE_MAGIC 0xd5715e0f
+
+enum SWDProfilePoint
+{
+    PROFILE_STREAM_WRITE,
+    PROFILE_POLL,
+    PROFILE_PROCESS_PACKET,
+    PROFILE_PUT_CHAR,
+    PROFILE_POINTS
+};
+
+#if SWD_PROFILE
+
+#include <Arduino.h>
+
+struct SWDProfileEntry
+{
+    const char *name;
+    uint32_t calls;
+    uint32_t min;
+    uint32_t max;
+    uint64_t total;
+};
+
+class SWDProfile
+{
+public:
+    SWDProfile();
+
+    void clear();
+
+    uint32_t magic;
+    uint32_t count;
+    SWDProfileEntry entries[PROFILE_POINTS];
+};
+
+extern SWDProfile swdProfile;
+
+// Times from construction to the end of the enclosing scope
+class SWDProfileScope
+{
+public:
+    SWDProfileScope(SWDProfileEntry &entry_)
+        : entry(entry_),
+          start(DWT->CYCCNT)
+    {
+    }
+
+    ~SWDProfileScope()
+    {
+        uint32_t cycles = DWT->CYCCNT - start;
+        entry.calls++;
+        entry.total += cycles;
+        if (cycles < entry.min || entry.calls == 1)
+            entry.min = cycles;
+        if (cycles > entry.max)
+            entry.max = cycles;
+    }
+
+protected:
+    SWDProfileEntry &entry;
+    uint32_t start;
+};
+
+#define SWD_PROFILE_SCOPE(point) \
+    SWDProfileScope swdProfileScope(swdProfile.entries[point])
+
+#else
+
+#define SWD_PROFILE_SCOPE(point)
+
+#endif
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <Arduino.h>
+#include <string.h>
+
+#define SWDSNAPSHOT_MAGIC 0xd5715e0e
+
+// A copy of a struct the host can read consistently over SWD without
+// stopping the target. publish() copies the value between two sequence
+// numbers. The trailing sequenceCheck is written before the data and the
+// leading sequence after it. The host reads the whole block in one
+// transfer in increasing address order and the copy is only used if both
+// numbers match, otherwise it reads again.
+//
+// The layout seen by the host is:
+//
+//   magic          4 bytes SWDSNAPSHOT_MAGIC
+//   id             2 bytes to tell several snapshots apart
+//   size           2 bytes sizeof(T)
+//   sequence       4 bytes
+//   data           sizeof(T) rounded up to 4 bytes
+//   sequenceCheck  4 bytes
+//
+// For example:
+//
+// struct Health { uint32_t uptime; uint16_t errors; uint8_t state; };
+// SWDSnapshot<Health> health(1);
+//
+// health.publish(current);
+template <typename T>
+class SWDSnapshot
+{
+public:
+    SWDSnapshot(uint16_t id_ = 0)
+        : magic(SWDSNAPSHOT_MAGIC),
+          id(id_),
+          size(sizeof(T)),
+          sequence(0),
+          sequenceCheck(0)
+    {
+        memset(data, 0, sizeof(data));
+    }
+
+    // Must not be called from an interrupt while another publish() is in
+    // progress
+    void publish(const T &value)
+    {
+        uint32_t next = sequence + 1;
+
+        sequenceCheck = next;
+        // Order the stores as seen by the debugger
+        __DMB();
+        memcpy(data, &value, sizeof(T));
+        __DMB();
+        sequence = next;
+    }
+
+    // Last value published
+    void get(T &value) const { memcpy(&value, data, sizeof(T)); }
+
+    uint32_t getSequence() const { return sequence; }
+
+protected:
+    uint32_t magic;
+    uint16_t id;
+    uint16_t size;
+    volatile uint32_t sequence;
+    // Bytes rather than T so the trailer is at a fixed place for the host
+    uint8_t data[(sizeof(T) + 3) & ~3];
+    volatile uint32_t sequenceCheck;
+
+    static_assert(sizeof(T) <= 0xffff, "Snapshot too large");
+};
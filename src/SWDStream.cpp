@@ -1,18 +1,38 @@
 #include "SWDStream.h"
+#include "SWDProfile.h"
+
+// For __DMB() and the DWT registers
+#include <Arduino.h>
 
 SWDStream::SWDStream()
-    : magic(SWDSERIAL_MAGIC),
+    : magic(0),
       outHead(0),
       outTail(0),
       inHead(0),
-      inTail(0)
+      inTail(0),
+      attached(0),
+      logMask(SWD_LOG_DEFAULT)
+#if SWDSTREAM_TIMESTAMP
+      , lineStart(true)
+#endif
+      , reserved(0)
 {
+#if SWDSTREAM_TIMESTAMP && defined(SWDSTREAM_TIMESTAMP_DWT)
+    // Start the cycle counter. A debugger may have done this already
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+#endif
+
+    // The host takes the magic number to mean the indices are valid, for
+    // example when it reattaches after a reset, so it is written last
+    __DMB();
+    magic = SWDSERIAL_MAGIC;
 }
 
 // Stream overrides
 int SWDStream::available()
 {
-    return (inHead - inTail) % sizeof(inBuffer);
+    return (uint8_t)(inHead - inTail);
 }
 
 int SWDStream::read()
@@ -35,7 +55,7 @@ int SWDStream::peek()
     if (inHead == inTail)
         return -1;
     else
-        return inBuffer[inTail];
+        return inBuffer[(uint8_t)(inTail + 1)];
 }
 
 // Print overrides
@@ -46,15 +66,34 @@ size_t SWDStream::write(uint8_t c)
 
 size_t SWDStream::write(const uint8_t *buffer, size_t size)
 {
+    SWD_PROFILE_SCOPE(PROFILE_STREAM_WRITE);
+
     size_t i;
     for (i = 0; i < size; i++)
     {
-        int next = outHead + 1;
-        if (next >= sizeof(outBuffer))
-            next = 0;
+#if SWDSTREAM_TIMESTAMP
+        if (lineStart)
+            putTimestamp();
 
-        if (next == outTail)
-        {
+        if (buffer[i] == '\n')
+            lineStart = true;
+#endif
+        if (!putByte(buffer[i]))
+            break;
+    }
+    
+    return i;
+}
+
+// Returns false if the buffer is full
+bool SWDStream::putByte(uint8_t c)
+{
+    int next = outHead + 1;
+    if (next >= sizeof(outBuffer))
+        next = 0;
+
+    if (next == outTail)
+    {
 #if 1
         // Overwrite
         int next_tail = outTail + 1;
@@ -62,25 +101,92 @@ size_t SWDStream::write(const uint8_t *buffer, size_t size)
             next_tail = 0;
         outTail = next_tail;
 #else
-            break;
+        return false;
 #endif
-        }
-        
-        outBuffer[next] = buffer[i];
-        outHead = next;
     }
-    
-    return i;
+
+    outBuffer[next] = c;
+    outHead = next;
+
+    return true;
 }
 
-int SWDStream::availableForWrite()
+#if SWDSTREAM_TIMESTAMP
+void SWDStream::putTimestamp()
+{
+    uint32_t t = SWDSTREAM_TIMESTAMP_COUNTER;
+    putByte(SWDSTREAM_TIMESTAMP_MARKER);
+    putByte(t);
+    putByte(t >> 8);
+    putByte(t >> 16);
+    putByte(t >> 24);
+    lineStart = false;
+}
+#endif
+
+// The indices are 8 bits so wrap around the 256 byte buffer by themselves
+size_t SWDStream::reserve(size_t size, SWDSpan &span)
 {
+#if SWDSTREAM_TIMESTAMP
+    if (lineStart && size > 0)
+        putTimestamp();
+#endif
+
+    if (size > sizeof(outBuffer) - 1)
+        size = sizeof(outBuffer) - 1;
+
+    uint8_t free = sizeof(outBuffer) - 1 - (uint8_t)(outHead - outTail);
+    if (size > free)
+    {
 #if 1
-    return sizeof(outBuffer);
+        // Overwrite
+        outTail += size - free;
 #else
-    if (outHead < outTail)
-        return outTail - outHead;
+        size = free;
+#endif
+    }
+
+    uint8_t start = outHead + 1;
+    size_t to_end = sizeof(outBuffer) - start;
+
+    span.first = &outBuffer[start];
+    if (size <= to_end)
+    {
+        span.firstSize = size;
+        span.second = nullptr;
+        span.secondSize = 0;
+    }
     else
-        return sizeof(outBuffer) + outTail - outHead;
+    {
+        span.firstSize = to_end;
+        span.second = outBuffer;
+        span.secondSize = size - to_end;
+    }
+
+    reserved = size;
+    return size;
+}
+
+void SWDStream::commit(size_t size)
+{
+    if (size > reserved)
+        size = reserved;
+    reserved = 0;
+
+    if (size == 0)
+        return;
+
+#if SWDSTREAM_TIMESTAMP
+    if (outBuffer[(uint8_t)(outHead + size)] == '\n')
+        lineStart = true;
 #endif
+
+    outHead += size;
+}
+
+// Writes never block as old output is overwritten but report the space the
+// host has freed so writers can pace themselves
+int SWDStream::availableForWrite()
+{
+    return sizeof(outBuffer) - 1 - (uint8_t)(outHead - outTail);
 }
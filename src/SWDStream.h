@@ -2,7 +2,38 @@
 
 #include <Stream.h>
 
-#define SWDSERIAL_MAGIC 0xd5715e0d
+#include "SWDLog.h"
+
+// Changed with any change to the layout of the control block so a host
+// never uses the wrong offsets. 0xd5715e0d was the layout before logMask
+// and 0xd5715e11 the one before attached
+#define SWDSERIAL_MAGIC 0xd5715e13
+
+// Start each line of output with SWDSTREAM_TIMESTAMP_MARKER followed by the
+// value of SWDSTREAM_TIMESTAMP_COUNTER as 4 bytes little endian. The host
+// reads the same counter to convert these to host time. The default is the
+// DWT cycle counter which the constructor enables
+#ifndef SWDSTREAM_TIMESTAMP
+#define SWDSTREAM_TIMESTAMP 0
+#endif
+#ifndef SWDSTREAM_TIMESTAMP_MARKER
+#define SWDSTREAM_TIMESTAMP_MARKER 0x1e
+#endif
+#ifndef SWDSTREAM_TIMESTAMP_COUNTER
+#define SWDSTREAM_TIMESTAMP_COUNTER (DWT->CYCCNT)
+#define SWDSTREAM_TIMESTAMP_DWT 1
+#endif
+
+// Space in the output ring returned by SWDStream::reserve(). If the space
+// wraps around the end of the buffer it is in two parts otherwise second
+// is null and secondSize is zero
+struct SWDSpan
+{
+    uint8_t *first;
+    size_t firstSize;
+    uint8_t *second;
+    size_t secondSize;
+};
 
 class SWDStream : public Stream
 {
@@ -19,6 +50,21 @@ public:
     virtual size_t write(const uint8_t *buffer, size_t size);
     virtual int availableForWrite();
 
+    // Get up to size bytes of the output buffer to fill in place. Returns
+    // the amount reserved which is limited to the buffer size. Older output
+    // is dropped to make room. Nothing is visible to the host until
+    // commit() is called with the number of bytes filled in. With
+    // SWDSTREAM_TIMESTAMP only a line start is stamped so a span should not
+    // hold more than one line
+    size_t reserve(size_t size, SWDSpan &span);
+    void commit(size_t size);
+
+    // True if a message with these level and category bits should be
+    // output. See SWD_LOG()
+    bool logEnabled(uint32_t bits) const { return (logMask & bits) == bits; }
+    uint32_t getLogMask() const { return logMask; }
+    void setLogMask(uint32_t mask) { logMask = mask; }
+
 protected:
     // Implement 255 (256-1) byte circular buffers for input and output
     // If head==tail then the buffer is empty. If head+1==tail the buffer is full
@@ -28,8 +74,25 @@ protected:
     uint8_t outTail;
     uint8_t inHead;
     uint8_t inTail;
+    // Set by the host when it attaches and only cleared by the constructor.
+    // The host cannot use the indices to tell a restart as the output tail
+    // also moves when the ring overflows
+    volatile uint32_t attached;
+    // Written by the host
+    volatile uint32_t logMask;
     uint8_t outBuffer[256];
     uint8_t inBuffer[256];
+
+    // Not read by the host so kept after the buffers
+#if SWDSTREAM_TIMESTAMP
+    bool lineStart;
+#endif
+    uint8_t reserved;
+
+    bool putByte(uint8_t c);
+#if SWDSTREAM_TIMESTAMP
+    void putTimestamp();
+#endif
 };
 
         
@@ -0,0 +1,211 @@
+/*
+ * Copyright   : (c) 2024 by Denis Dowling
+ * Licence     : MIT, see LICENSE
+ * File        : TypedCommand
+ *
+ * Description : Commands with typed argument signatures
+ *
+ * Instead of calling the CommandParser parse functions a command can be
+ * written to take its arguments directly and registered with command<>().
+ * The argument types are taken from the function signature, the arguments
+ * are decoded in order into a tuple and the help text is generated at
+ * compile time. For example:
+ *
+ * bool set_cmd(CommandParser *c, int channel, float value, Str<16> name);
+ *
+ * const Command commands[] =
+ * {
+ *     command<set_cmd>("set", "Set a channel"),
+ *     ...
+ * };
+ *
+ * Shows in the help as "set <int> <float> <str> : Set a channel".
+ * Missing or extra arguments fail the command without calling it.
+ */
+#ifndef TYPED_COMMAND_H
+#define TYPED_COMMAND_H
+
+#include "CommandParser.h"
+
+#include <tuple>
+#include <utility>
+
+// Single word string argument of up to N characters
+template <uint8_t N>
+struct Str
+{
+    char value[N + 1];
+
+    operator const char *() const { return value; }
+};
+
+// Rest of the line including spaces of up to N characters
+template <uint8_t N>
+struct Rest
+{
+    char value[N + 1];
+
+    operator const char *() const { return value; }
+};
+
+// Integer argument given in hex
+struct Hex
+{
+    int value;
+
+    operator int() const { return value; }
+};
+
+// Decoding and help text for each supported argument type
+template <typename T>
+struct CommandArg;
+
+template <>
+struct CommandArg<uint8_t>
+{
+    static constexpr char name[] = "<byte>";
+    static bool parse(CommandParser *c, uint8_t &v) { return c->parseByte(&v); }
+};
+
+template <>
+struct CommandArg<int>
+{
+    static constexpr char name[] = "<int>";
+    static bool parse(CommandParser *c, int &v) { return c->parseInt(&v); }
+};
+
+template <>
+struct CommandArg<long>
+{
+    static constexpr char name[] = "<long>";
+    static bool parse(CommandParser *c, long &v) { return c->parseLong(&v); }
+};
+
+template <>
+struct CommandArg<Hex>
+{
+    static constexpr char name[] = "<hex>";
+    static bool parse(CommandParser *c, Hex &v) { return c->parseHex(&v.value); }
+};
+
+#if COMMAND_FLOAT
+template <>
+struct CommandArg<float>
+{
+    static constexpr char name[] = "<float>";
+    static bool parse(CommandParser *c, float &v) { return c->parseFloat(&v); }
+};
+#endif
+
+template <uint8_t N>
+struct CommandArg<Str<N> >
+{
+    static constexpr char name[] = "<str>";
+    static bool parse(CommandParser *c, Str<N> &v)
+    {
+        return c->parseString(v.value, N);
+    }
+};
+
+template <uint8_t N>
+struct CommandArg<Rest<N> >
+{
+    static constexpr char name[] = "<text...>";
+    static bool parse(CommandParser *c, Rest<N> &v)
+    {
+        return c->parseRest(v.value, N);
+    }
+};
+
+// Space separated argument names built at compile time
+template <size_t N>
+struct CommandArgText
+{
+    char text[N];
+};
+
+template <typename... Args>
+constexpr size_t commandArgTextLength()
+{
+    // Each name includes a NUL that becomes a space or the terminator
+    return (sizeof(CommandArg<Args>::name) + ... + (sizeof...(Args) == 0));
+}
+
+template <typename... Args>
+constexpr CommandArgText<commandArgTextLength<Args...>()> commandArgText()
+{
+    CommandArgText<commandArgTextLength<Args...>()> r = {};
+    const char *names[] = { CommandArg<Args>::name... };
+
+    size_t p = 0;
+    for (const char *n : names)
+    {
+        if (p != 0)
+            r.text[p++] = ' ';
+
+        while (*n != '\0')
+            r.text[p++] = *n++;
+    }
+
+    return r;
+}
+
+template <auto F>
+struct TypedCommand;
+
+template <typename... Args, bool (*F)(CommandParser *, Args...)>
+struct TypedCommand<F>
+{
+    static constexpr CommandArgText<commandArgTextLength<Args...>()> help =
+        commandArgText<Args...>();
+
+    static bool dispatch(CommandParser *c)
+    {
+        std::tuple<Args...> values;
+        if (!decode(c, values, std::index_sequence_for<Args...>()))
+            return false;
+
+        if (!c->endOfArguments())
+        {
+            c->print(PSTR("Too many arguments"));
+            c->printLine();
+            return false;
+        }
+
+        return std::apply([c](Args &... v) { return F(c, v...); }, values);
+    }
+
+    template <size_t... I>
+    static bool decode([[maybe_unused]] CommandParser *c,
+                       std::tuple<Args...> &values,
+                       std::index_sequence<I...>)
+    {
+        // Arguments are decoded in order stopping at the first failure
+        return (decodeArg(c, std::get<I>(values)) && ...);
+    }
+
+    template <typename T>
+    static bool decodeArg(CommandParser *c, T &v)
+    {
+        if (CommandArg<T>::parse(c, v))
+            return true;
+
+        c->print(PSTR("Expected "));
+        c->print(CommandArg<T>::name);
+        c->printLine();
+        return false;
+    }
+};
+
+// Build a command table entry for a function taking typed arguments
+template <auto F>
+constexpr Command command(const char *name, const char *description)
+{
+    return Command { name,
+                     sizeof(TypedCommand<F>::help.text) > 1 ?
+                     TypedCommand<F>::help.text : 0,
+                     TypedCommand<F>::dispatch,
+                     description };
+}
+
+#endif
@@ -0,0 +1,282 @@
+// Checks CommandParser::putNumber() against the division based version it
+// replaced with a sample of values in several bases with every width and
+// leading zero setting. With --all the base 10 digits of every 32 bit value
+// are checked as well, which takes minutes. Finally the time per call of
+// both is shown.
+//
+// The parser is built in so its static helpers can be checked directly
+#include "CommandParser.cpp"
+
+#include <stdio.h>
+
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+
+unsigned long millis()
+{
+    return 0;
+}
+
+unsigned long micros()
+{
+    return 0;
+}
+
+// Keeps everything the parser writes
+class OutputStream : public Stream
+{
+public:
+    std::string output;
+
+    size_t write(uint8_t c) override
+    {
+        output += (char)c;
+        return 1;
+    }
+
+    size_t write(const uint8_t *buf, size_t size) override
+    {
+        output.append((const char *)buf, size);
+        return size;
+    }
+
+    int availableForWrite() override { return 1024; }
+    int available() override { return 0; }
+    int read() override { return -1; }
+    int peek() override { return -1; }
+};
+
+static const Command commands[] =
+{
+    { 0, 0, 0, 0 }
+};
+
+// putNumber() as it was before the digits were found without division
+static void referenceNumber(std::string &out,
+                            unsigned long i,
+                            int8_t width,
+                            bool leading_zeros,
+                            uint8_t base,
+                            uint8_t num_factors,
+                            unsigned long max_factor)
+{
+    if (width > 0)
+    {
+        while (width > num_factors)
+        {
+            width--;
+            out += leading_zeros ? '0' : ' ';
+        }
+
+        while (num_factors > width && i < max_factor)
+        {
+            num_factors--;
+            max_factor /= base;
+        }
+    }
+
+    unsigned long f = max_factor;
+    while (f != 0)
+    {
+        unsigned int d = i/f;
+
+        if (d != 0 || leading_zeros || f == 1)
+        {
+            out += d < 10 ? '0' + d : 'A' + d - 10;
+            i -= d*f;
+            leading_zeros = true;
+
+            if (width < 0)
+                width++;
+        }
+        else if (width > 0)
+            out += ' ';
+
+        f /= base;
+    }
+
+    while (width < 0)
+    {
+        out += ' ';
+        width++;
+    }
+}
+
+struct Format
+{
+    uint8_t base;
+    uint8_t numFactors;
+    unsigned long maxFactor;
+};
+
+// As used by printDecimal(), printHex() and printBinary() plus octal and
+// two bases that are converted with division
+static const Format formats[] =
+{
+    { 10, 10, 1000000000 },
+    { 16, 8, 0x10000000 },
+    { 2, 32, 0x80000000 },
+    { 8, 11, 010000000000 },
+    { 3, 21, 3486784401 },
+    { 36, 7, 2176782336 },
+};
+
+// Compare toDigits() for every value with a decimal counter. Both have the
+// least significant digit first
+static bool checkAllDecimal()
+{
+    char expected[10] = { '0' };
+    uint8_t expected_size = 1;
+    uint32_t i = 0;
+    do
+    {
+        char digits[32];
+        uint8_t n = toDigits(i, 10, digits);
+        if (n != expected_size || memcmp(digits, expected, n) != 0)
+        {
+            printf("Value %lu gave %.*s reversed\n", (unsigned long)i, n,
+                   digits);
+            return false;
+        }
+
+        uint8_t p = 0;
+        while (p < expected_size && expected[p] == '9')
+            expected[p++] = '0';
+        if (p == expected_size)
+            expected[expected_size++] = '1';
+        else
+            expected[p]++;
+    }
+    while (++i != 0);
+
+    return true;
+}
+
+static std::vector<uint32_t> sampleValues()
+{
+    std::vector<uint32_t> values;
+
+    // Each digit position changing in every base
+    for (const Format &f : formats)
+    {
+        for (uint64_t p = 1; p <= 0xffffffff; p *= f.base)
+        {
+            values.push_back(p - 1);
+            values.push_back(p);
+            values.push_back(p + 1);
+        }
+    }
+
+    for (uint32_t i = 0; i <= 20000; i++)
+        values.push_back(i);
+
+    std::mt19937 rng(1);
+    for (int i = 0; i < 20000; i++)
+        values.push_back(rng() >> (rng() % 32));
+
+    values.push_back(0xffffffff);
+
+    return values;
+}
+
+static bool checkFormats(CommandParser &parser, OutputStream &stream,
+                         const std::vector<uint32_t> &values)
+{
+    unsigned long checked = 0;
+    for (const Format &f : formats)
+    {
+        int max_width = f.numFactors + 2;
+        for (uint32_t v : values)
+        {
+            for (int width = -max_width; width <= max_width; width++)
+            {
+                for (int zeros = 0; zeros < 2; zeros++)
+                {
+                    std::string expected;
+                    referenceNumber(expected, v, width, zeros, f.base,
+                                    f.numFactors, f.maxFactor);
+
+                    parser.putNumber(v, width, zeros, f.base,
+                                     f.numFactors, f.maxFactor);
+                    parser.flush();
+
+                    if (stream.output != expected)
+                    {
+                        printf("Value %lu base %d width %d leading zeros %d "
+                               "gave '%s' not '%s'\n",
+                               (unsigned long)v, f.base, width, zeros,
+                               stream.output.c_str(), expected.c_str());
+                        return false;
+                    }
+
+                    stream.output.clear();
+                    checked++;
+                }
+            }
+        }
+    }
+
+    printf("Checked %lu formatted values\n", checked);
+    return true;
+}
+
+// Time to format each of the values in base 10 with both versions. The
+// reference skips the output buffering of the parser so it is favoured
+static void benchmark(CommandParser &parser, OutputStream &stream,
+                      const std::vector<uint32_t> &values)
+{
+    typedef std::chrono::steady_clock Clock;
+    const int repeats = 20;
+
+    Clock::time_point start = Clock::now();
+    for (int r = 0; r < repeats; r++)
+    {
+        for (uint32_t v : values)
+        {
+            parser.putNumber(v, 0, false, 10, 10, 1000000000);
+            parser.flush();
+            stream.output.clear();
+        }
+    }
+    Clock::time_point mid = Clock::now();
+    for (int r = 0; r < repeats; r++)
+    {
+        for (uint32_t v : values)
+        {
+            stream.output.clear();
+            referenceNumber(stream.output, v, 0, false, 10, 10, 1000000000);
+        }
+    }
+    Clock::time_point end = Clock::now();
+
+    double calls = (double)repeats * values.size();
+    printf("putNumber %.1fns per call, division based %.1fns per call\n",
+           std::chrono::duration<double, std::nano>(mid - start).count() /
+           calls,
+           std::chrono::duration<double, std::nano>(end - mid).count() /
+           calls);
+}
+
+int main(int argc, char **argv)
+{
+    OutputStream stream;
+    CommandParser parser(stream, commands);
+
+    std::vector<uint32_t> values = sampleValues();
+    if (!checkFormats(parser, stream, values))
+        return 1;
+
+    if (argc > 1 && strcmp(argv[1], "--all") == 0)
+    {
+        if (!checkAllDecimal())
+            return 1;
+
+        printf("Checked all 32 bit values in base 10\n");
+    }
+
+    benchmark(parser, stream, values);
+
+    return 0;
+}
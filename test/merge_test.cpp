@@ -0,0 +1,196 @@
+// Feeds LogMerger the lines of many sources in pieces with random delivery
+// delays. While the delays are within the window the merged lines must be
+// in time order with none counted late. With delays longer than the window
+// some are late but every line must still come out once and each source in
+// the order it was written.
+#include "LogMerger.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <random>
+#include <string>
+#include <vector>
+
+#define SOURCES 48
+#define LINES_PER_SOURCE 200
+#define WINDOW_US 50000
+
+typedef LogMerger::Clock Clock;
+
+// A piece of a line as it reaches the host
+struct Delivery
+{
+    long delivered;
+    size_t source;
+    // When the line started if it starts in this piece
+    long start;
+    std::string data;
+    // Keeps the pieces of each source in order
+    unsigned long order;
+};
+
+struct Result
+{
+    unsigned long lines;
+    unsigned long late;
+    unsigned long outOfOrder;
+    bool sourcesInOrder;
+};
+
+static Clock::time_point at(long us)
+{
+    return Clock::time_point(std::chrono::microseconds(us));
+}
+
+static bool run(long max_jitter, Result &result)
+{
+    std::mt19937 rng(max_jitter);
+    std::vector<Delivery> deliveries;
+    unsigned long order = 0;
+
+    for (size_t s = 0; s < SOURCES; s++)
+    {
+        long t = rng() % 1000;
+        long delivered = 0;
+        for (int n = 0; n < LINES_PER_SOURCE; n++)
+        {
+            t += rng() % 2000;
+            // A source is read in order so its lines never overtake
+            long jitter = rng() % (max_jitter + 1);
+            delivered = std::max(delivered, t + jitter);
+
+            char text[64];
+            snprintf(text, sizeof(text), "line %ld %zu %d\r\n", t, s, n);
+            std::string line = text;
+
+            // Up to three pieces delivered together
+            size_t cut1 = rng() % line.size();
+            size_t cut2 = cut1 + rng() % (line.size() - cut1);
+            size_t cuts[4] = { 0, cut1, cut2, line.size() };
+            for (int k = 0; k < 3; k++)
+            {
+                if (cuts[k + 1] == cuts[k])
+                    continue;
+
+                Delivery d;
+                d.delivered = delivered;
+                d.source = s;
+                d.start = t;
+                d.data = line.substr(cuts[k], cuts[k + 1] - cuts[k]);
+                d.order = order++;
+                deliveries.push_back(d);
+            }
+        }
+    }
+
+    std::sort(deliveries.begin(), deliveries.end(),
+              [](const Delivery &a, const Delivery &b) {
+                  if (a.delivered != b.delivered)
+                      return a.delivered < b.delivered;
+                  return a.order < b.order;
+              });
+
+    std::string merged;
+    LogMerger merger([&merged](const char *data, size_t size) {
+        merged.append(data, size);
+    });
+    merger.setWindow(WINDOW_US * 1e-6);
+
+    for (size_t s = 0; s < SOURCES; s++)
+    {
+        char tag[16];
+        snprintf(tag, sizeof(tag), "s%zu", s);
+        merger.addSource(tag);
+    }
+
+    for (const Delivery &d : deliveries)
+    {
+        merger.flush(at(d.delivered));
+        merger.receive(d.source, d.data.data(), d.data.size(), at(d.start));
+    }
+    merger.flushAll();
+
+    // Each output line is the time, the tag and the text
+    result.lines = 0;
+    result.late = merger.getLate();
+    result.outOfOrder = 0;
+    result.sourcesInOrder = true;
+    std::vector<int> next(SOURCES, 0);
+    long last = 0;
+    size_t pos = 0;
+    while (pos < merged.size())
+    {
+        size_t nl = merged.find('\n', pos);
+        if (nl == std::string::npos)
+            nl = merged.size();
+        std::string line = merged.substr(pos, nl - pos);
+        pos = nl + 1;
+
+        long t;
+        size_t s;
+        int n;
+        size_t text = line.find("line ");
+        if (text == std::string::npos ||
+            sscanf(line.c_str() + text, "line %ld %zu %d", &t, &s, &n) != 3 ||
+            s >= SOURCES || line.back() == '\r')
+        {
+            printf("Bad merged line '%s'\n", line.c_str());
+            return false;
+        }
+
+        if (t < last)
+            result.outOfOrder++;
+        last = std::max(last, t);
+
+        if (n != next[s])
+            result.sourcesInOrder = false;
+        next[s] = n + 1;
+
+        result.lines++;
+    }
+
+    printf("Jitter up to %3ldms with a %dms window: %lu lines, %lu late, "
+           "%lu out of order\n", max_jitter / 1000, WINDOW_US / 1000,
+           result.lines, result.late, result.outOfOrder);
+
+    if (result.lines != SOURCES * LINES_PER_SOURCE || !result.sourcesInOrder)
+    {
+        printf("Lines were lost or a source was out of order\n");
+        return false;
+    }
+
+    return true;
+}
+
+int main()
+{
+    Result result;
+
+    // Within the window
+    if (!run(20000, result))
+        return 1;
+
+    if (result.late != 0 || result.outOfOrder != 0)
+        return 1;
+
+    // Longer than the window
+    if (!run(80000, result))
+        return 1;
+
+    if (result.late == 0)
+    {
+        printf("No late lines were counted\n");
+        return 1;
+    }
+
+    // Late lines are output next rather than in order
+    if (result.outOfOrder > result.late)
+    {
+        printf("More lines out of order than were counted late\n");
+        return 1;
+    }
+
+    return 0;
+}
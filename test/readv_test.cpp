@@ -0,0 +1,278 @@
+// Checks Probe::readv() against a probe in host memory that counts its
+// transfers. Random scattered regions must come back with the right bytes,
+// and gaps that cost more to read than another transfer must not be read.
+// Finally the transfers and modelled transfer time are shown for regions
+// spread over more and more memory, read one at a time and with readv().
+#include "Probe.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#define RAM_BASE 0x20000000
+#define RAM_SIZE 0x10000
+
+// Costs of the simulated probe the readv() commit was measured against
+#define FIXED_COST 250e-6
+#define BYTE_COST 0.1e-6
+
+class CountingProbe : public Probe
+{
+public:
+    std::vector<uint8_t> ram;
+    unsigned long transfers;
+    unsigned long bytes;
+
+    CountingProbe()
+        : ram(RAM_SIZE),
+          transfers(0),
+          bytes(0)
+    {
+        for (size_t i = 0; i < ram.size(); i++)
+            ram[i] = i * 13 + (i >> 8);
+    }
+
+    bool read(uint8_t *ptr, size_t address, size_t size) override
+    {
+        if (address < RAM_BASE || address + size > RAM_BASE + RAM_SIZE)
+            return false;
+
+        memcpy(ptr, &ram[address - RAM_BASE], size);
+        transfers++;
+        bytes += size;
+        return true;
+    }
+
+    bool write(uint8_t * /*ptr*/, size_t /*address*/, size_t /*size*/) override
+    {
+        return false;
+    }
+
+    void getRAM(size_t &base, size_t &size) override
+    {
+        base = RAM_BASE;
+        size = RAM_SIZE;
+    }
+
+    void getFlash(size_t &base, size_t &size) override
+    {
+        base = 0;
+        size = 0;
+    }
+
+    double getFixedCost() const override { return FIXED_COST; }
+    double getByteCost() const override { return BYTE_COST; }
+
+    double cost() const
+    {
+        return transfers * FIXED_COST + bytes * BYTE_COST;
+    }
+
+    void clearCounts()
+    {
+        transfers = 0;
+        bytes = 0;
+    }
+};
+
+struct Regions
+{
+    std::vector<ProbeRegion> regions;
+    std::vector<std::vector<uint8_t>> buffers;
+};
+
+// Count regions of 1 to 16 bytes at any alignment in span bytes of RAM.
+// Regions may overlap
+static void makeRegions(std::mt19937 &rng, size_t count, size_t span,
+                        Regions &r)
+{
+    size_t start = RAM_BASE + rng() % (RAM_SIZE - span + 1);
+
+    r.regions.resize(count);
+    r.buffers.resize(count);
+    for (size_t i = 0; i < count; i++)
+    {
+        size_t size = 1 + rng() % 16;
+        r.buffers[i].assign(size, 0);
+        r.regions[i].ptr = r.buffers[i].data();
+        r.regions[i].address = start + rng() % (span - size + 1);
+        r.regions[i].size = size;
+    }
+}
+
+static bool checkBytes(const CountingProbe &probe, const Regions &r)
+{
+    for (size_t i = 0; i < r.regions.size(); i++)
+    {
+        const ProbeRegion &g = r.regions[i];
+        if (memcmp(g.ptr, &probe.ram[g.address - RAM_BASE], g.size) != 0)
+        {
+            printf("Region %zu of %zu bytes at 0x%zx has the wrong bytes\n",
+                   i, g.size, g.address);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Every transfer must cover its regions and only read gaps worth reading.
+// Neighbouring transfers must be too far apart to be worth joining
+static bool checkPlan(const std::vector<ProbeRegion> &regions,
+                      const Probe::ReadPlan &plan)
+{
+    size_t max_gap = FIXED_COST / BYTE_COST;
+
+    for (size_t k = 0; k < plan.transfers.size(); k++)
+    {
+        const Probe::Transfer &t = plan.transfers[k];
+        if (t.address % 4 != 0 || t.size % 4 != 0)
+        {
+            printf("Transfer at 0x%zx of %zu bytes is not whole words\n",
+                   t.address, t.size);
+            return false;
+        }
+
+        size_t covered = t.address;
+        for (size_t i = t.first; i < t.last; i++)
+        {
+            const ProbeRegion &g = regions[plan.order[i]];
+            if (g.address < t.address ||
+                g.address + g.size > t.address + t.size)
+            {
+                printf("Region at 0x%zx is outside its transfer\n",
+                       g.address);
+                return false;
+            }
+
+            size_t start = g.address & ~(size_t)3;
+            if (start > covered && start - covered > max_gap)
+            {
+                printf("Transfer at 0x%zx reads a gap of %zu bytes\n",
+                       t.address, start - covered);
+                return false;
+            }
+
+            covered = std::max(covered, (g.address + g.size + 3) &
+                               ~(size_t)3);
+        }
+
+        if (k > 0)
+        {
+            const Probe::Transfer &p = plan.transfers[k - 1];
+            if (t.address - (p.address + p.size) <= max_gap)
+            {
+                printf("Transfers at 0x%zx and 0x%zx should be joined\n",
+                       p.address, t.address);
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+// Regions either side of the largest gap worth reading
+static bool checkGapLimit()
+{
+    size_t max_gap = FIXED_COST / BYTE_COST;
+    Probe::ReadPlan plan;
+    uint8_t a[4], b[4];
+
+    for (size_t gap = max_gap - 8; gap <= max_gap + 8; gap += 4)
+    {
+        ProbeRegion regions[2] = {
+            { a, RAM_BASE, 4 },
+            { b, RAM_BASE + 4 + gap, 4 } };
+        Probe::planReads(regions, 2, FIXED_COST, BYTE_COST, plan);
+
+        size_t expected = gap <= max_gap ? 1 : 2;
+        if (plan.transfers.size() != expected)
+        {
+            printf("Gap of %zu bytes gave %zu transfers not %zu\n", gap,
+                   plan.transfers.size(), expected);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+int main()
+{
+    if (!checkGapLimit())
+        return 1;
+
+    CountingProbe probe;
+    std::mt19937 rng(1);
+    Probe::ReadPlan plan;
+    Regions r;
+
+    const size_t spans[] = { 64, 4096, 32768, 65536 };
+    const int rounds = 1000;
+    for (size_t span : spans)
+    {
+        double single_cost = 0;
+        double merged_cost = 0;
+        unsigned long single_transfers = 0;
+        unsigned long merged_transfers = 0;
+
+        for (int round = 0; round < rounds; round++)
+        {
+            makeRegions(rng, 16, span, r);
+
+            // One transfer per region
+            double prev_single_cost = single_cost;
+            probe.clearCounts();
+            for (const ProbeRegion &g : r.regions)
+                probe.read(g.ptr, g.address, g.size);
+            single_cost += probe.cost();
+            single_transfers += probe.transfers;
+
+            for (auto &b : r.buffers)
+                memset(b.data(), 0, b.size());
+
+            probe.clearCounts();
+            if (!probe.readv(r.regions))
+            {
+                printf("readv() failed\n");
+                return 1;
+            }
+            merged_cost += probe.cost();
+            merged_transfers += probe.transfers;
+
+            if (!checkBytes(probe, r))
+                return 1;
+
+            Probe::planReads(r.regions.data(), r.regions.size(),
+                             FIXED_COST, BYTE_COST, plan);
+            if (!checkPlan(r.regions, plan))
+                return 1;
+
+            if (probe.cost() > single_cost - prev_single_cost)
+            {
+                printf("readv() cost more than reading each region\n");
+                return 1;
+            }
+
+            if (plan.transfers.size() != probe.transfers)
+            {
+                printf("readv() made %lu transfers for a plan of %zu\n",
+                       probe.transfers, plan.transfers.size());
+                return 1;
+            }
+        }
+
+        printf("16 regions over %5zu bytes: %5.2f transfers %.2fms -> "
+               "%5.2f transfers %.2fms\n", span,
+               (double)single_transfers / rounds,
+               single_cost * 1e3 / rounds,
+               (double)merged_transfers / rounds,
+               merged_cost * 1e3 / rounds);
+    }
+
+    return 0;
+}
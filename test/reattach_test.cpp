@@ -0,0 +1,217 @@
+// Records a session with an SWDStream in host memory where the output ring
+// overflows between polls, then a restart where the magic number is never
+// seen missing. Checks the channel reports only the restart as a reset, both
+// live and when the recording is played back. The replay also makes a read
+// that was never recorded, which must fail without losing its place.
+#include "SWDStream.h"
+
+#include "Channel.h"
+#include "Recording.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <new>
+#include <string>
+#include <vector>
+
+#define RAM_BASE 0x20000000
+#define RAM_SIZE 0x1000
+#define RECORDING_FILE "reattach_test.rec"
+
+unsigned long millis()
+{
+    return 0;
+}
+
+unsigned long micros()
+{
+    return 0;
+}
+
+// Target RAM that the firmware side of the test runs in
+class MemoryProbe : public Probe
+{
+public:
+    std::vector<uint8_t> ram;
+
+    MemoryProbe()
+        : ram(RAM_SIZE)
+    {
+    }
+
+    bool read(uint8_t *ptr, size_t address, size_t size) override
+    {
+        if (address < RAM_BASE || address + size > RAM_BASE + RAM_SIZE)
+            return false;
+
+        memcpy(ptr, &ram[address - RAM_BASE], size);
+        return true;
+    }
+
+    bool write(uint8_t *ptr, size_t address, size_t size) override
+    {
+        if (address < RAM_BASE || address + size > RAM_BASE + RAM_SIZE)
+            return false;
+
+        memcpy(&ram[address - RAM_BASE], ptr, size);
+        return true;
+    }
+
+    void getRAM(size_t &base, size_t &size) override
+    {
+        base = RAM_BASE;
+        size = RAM_SIZE;
+    }
+
+    void getFlash(size_t &base, size_t &size) override
+    {
+        base = 0;
+        size = 0;
+    }
+};
+
+struct Result
+{
+    std::string output;
+    std::string input;
+    unsigned long resets;
+};
+
+static void watch(Channel &channel, Result &result)
+{
+    result.resets = 0;
+    channel.setReadCallback([&result](const uint8_t *data, size_t size) {
+        result.output.append((const char *)data, size);
+    });
+    channel.setResetCallback([&result]() {
+        result.resets++;
+    });
+}
+
+static bool record(Result &result)
+{
+    MemoryProbe memory;
+    void *block = &memory.ram[0x100];
+    SWDStream *stream = new (block) SWDStream();
+
+    RecordingProbe probe(memory);
+    if (!probe.open(RECORDING_FILE))
+        return false;
+
+    std::vector<Channel::Location> found = Channel::find(probe);
+    if (found.size() != 1)
+    {
+        printf("Found %zu control blocks\n", found.size());
+        return false;
+    }
+
+    Channel channel(probe, found[0]);
+    watch(channel, result);
+
+    int line = 0;
+    for (int round = 0; round < 50; round++)
+    {
+        // Several times the ring size so the firmware drops old output
+        for (int i = 0; i < 40; i++)
+        {
+            char buf[32];
+            snprintf(buf, sizeof(buf), "line %d\n", line++);
+            stream->write((const uint8_t *)buf, strlen(buf));
+        }
+
+        channel.write((const uint8_t *)"ab", 2);
+        if (channel.poll() < 0)
+            return false;
+
+        while (stream->available())
+            result.input += (char)stream->read();
+    }
+
+    if (result.resets != 0)
+    {
+        printf("Overflow reported as %lu resets\n", result.resets);
+        return false;
+    }
+
+    // A restart between polls
+    stream = new (block) SWDStream();
+    stream->write((const uint8_t *)"boot\n", 5);
+    if (channel.poll() < 0)
+        return false;
+
+    if (result.resets != 1 ||
+        result.output.compare(result.output.size() - 5, 5, "boot\n") != 0)
+    {
+        printf("Restart gave %lu resets\n", result.resets);
+        return false;
+    }
+
+    probe.close();
+    return true;
+}
+
+static bool replay(const Result &recorded)
+{
+    ReplayProbe probe;
+    if (!probe.open(RECORDING_FILE))
+        return false;
+
+    std::vector<Channel::Location> found = Channel::find(probe);
+    if (found.size() != 1)
+    {
+        printf("Replay found %zu control blocks\n", found.size());
+        return false;
+    }
+
+    Channel channel(probe, found[0]);
+    Result result;
+    watch(channel, result);
+
+    uint8_t buf[4];
+    if (probe.read(buf, RAM_BASE, sizeof(buf)) || probe.atEnd())
+    {
+        printf("Read that was not recorded did not fail in place\n");
+        return false;
+    }
+
+    while (!probe.atEnd())
+        channel.poll();
+
+    if (probe.getMismatches() != 1)
+    {
+        printf("Replay counted %zu reads not in the recording\n",
+               probe.getMismatches());
+        return false;
+    }
+
+    if (result.resets != recorded.resets ||
+        result.output != recorded.output)
+    {
+        printf("Replay gave %lu resets and %zu bytes not %lu and %zu\n",
+               result.resets, result.output.size(), recorded.resets,
+               recorded.output.size());
+        return false;
+    }
+
+    return true;
+}
+
+int main()
+{
+    Result result;
+    if (!record(result))
+        return 1;
+
+    if (result.input.size() != 100)
+    {
+        printf("Target got %zu bytes of input\n", result.input.size());
+        return 1;
+    }
+
+    if (!replay(result))
+        return 1;
+
+    printf("%zu bytes of output with one reset\n", result.output.size());
+    return 0;
+}
@@ -0,0 +1,188 @@
+// Publishes an 804 byte struct from one thread while another reads it with
+// Snapshot::read() through a probe that copies target RAM a word at a time
+// in increasing address order, as an ST-Link does. Every copy that is
+// accepted must be from a single publish. Raw reads of the same block are
+// also checked so the test fails if nothing was ever torn.
+#include "SWDSnapshot.h"
+
+#include "Snapshot.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <atomic>
+#include <new>
+#include <random>
+#include <thread>
+#include <vector>
+
+#define RAM_BASE 0x20000000
+#define RAM_SIZE 0x1000
+
+// Words read before letting the publisher run
+#define WORDS_PER_SLICE 16
+
+// Most times the publisher lets the reader run between publishes
+#define MAX_PAUSE 32
+
+#define READS 5000
+
+unsigned long millis()
+{
+    return 0;
+}
+
+unsigned long micros()
+{
+    return 0;
+}
+
+// Every word is the number of the publish that wrote it
+struct Value
+{
+    uint32_t words[201];
+};
+
+// Reads target RAM one word at a time and gives the publisher a chance to
+// run part way through each block
+class SlowProbe : public Probe
+{
+public:
+    std::vector<uint32_t> ram;
+
+    SlowProbe()
+        : ram(RAM_SIZE / 4)
+    {
+    }
+
+    bool read(uint8_t *ptr, size_t address, size_t size) override
+    {
+        if (address < RAM_BASE || address + size > RAM_BASE + RAM_SIZE ||
+            address % 4 != 0 || size % 4 != 0)
+            return false;
+
+        const volatile uint32_t *p = &ram[(address - RAM_BASE) / 4];
+        for (size_t i = 0; i < size / 4; i++)
+        {
+            uint32_t w = p[i];
+            memcpy(ptr + i * 4, &w, 4);
+
+            if (i % WORDS_PER_SLICE == WORDS_PER_SLICE - 1)
+                std::this_thread::yield();
+        }
+
+        return true;
+    }
+
+    bool write(uint8_t * /*ptr*/, size_t /*address*/, size_t /*size*/) override
+    {
+        return false;
+    }
+
+    void getRAM(size_t &base, size_t &size) override
+    {
+        base = RAM_BASE;
+        size = RAM_SIZE;
+    }
+
+    void getFlash(size_t &base, size_t &size) override
+    {
+        base = 0;
+        size = 0;
+    }
+};
+
+// True if every word of the data is the same as sequence
+static bool consistent(const uint8_t *data, uint32_t sequence)
+{
+    for (size_t i = 0; i < sizeof(Value); i += 4)
+    {
+        uint32_t w;
+        memcpy(&w, data + i, 4);
+        if (w != sequence)
+            return false;
+    }
+
+    return true;
+}
+
+int main()
+{
+    SlowProbe probe;
+    SWDSnapshot<Value> *snapshot =
+        new (&probe.ram[0x40]) SWDSnapshot<Value>(7);
+
+    std::vector<Snapshot::Location> found = Snapshot::find(probe);
+    if (found.size() != 1 || found[0].id != 7 ||
+        found[0].size != sizeof(Value))
+    {
+        printf("Found %zu snapshots\n", found.size());
+        return 1;
+    }
+
+    std::atomic<bool> stop(false);
+    std::thread publisher([snapshot, &stop]() {
+        Value v;
+        uint32_t n = 0;
+        std::minstd_rand rng(1);
+        while (!stop)
+        {
+            n++;
+            for (uint32_t &w : v.words)
+                w = n;
+            snapshot->publish(v);
+
+            // Some reads see no publish at all and some see several
+            for (unsigned int k = rng() % MAX_PAUSE; k > 0; k--)
+                std::this_thread::yield();
+        }
+    });
+
+    Snapshot reader(probe, found[0]);
+    reader.setMaxRetries(100);
+    std::vector<uint8_t> value;
+    uint32_t sequence;
+    unsigned long accepted = 0;
+    unsigned long bad = 0;
+    for (int i = 0; i < READS; i++)
+    {
+        if (reader.read(value, sequence) == 1)
+        {
+            accepted++;
+            if (value.size() != sizeof(Value) ||
+                !consistent(value.data(), sequence))
+                bad++;
+        }
+    }
+
+    // The same block without the sequence check
+    size_t block_size = Snapshot::DATA_OFFSET + sizeof(Value) + 4;
+    std::vector<uint8_t> block(block_size);
+    unsigned long torn = 0;
+    for (int i = 0; i < READS; i++)
+    {
+        probe.read(block.data(), found[0].address, block_size);
+        uint32_t first;
+        memcpy(&first, &block[Snapshot::DATA_OFFSET], 4);
+        if (!consistent(&block[Snapshot::DATA_OFFSET], first))
+            torn++;
+    }
+
+    stop = true;
+    publisher.join();
+
+    printf("%lu of %d reads accepted with %lu retries, %lu inconsistent. "
+           "%lu of %d raw reads torn\n", accepted, READS,
+           reader.getRetries(), bad, torn, READS);
+
+    if (bad != 0 || accepted == 0)
+        return 1;
+
+    if (torn == 0)
+    {
+        printf("No raw read was torn so the check was not tested\n");
+        return 1;
+    }
+
+    return 0;
+}
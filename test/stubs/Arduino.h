@@ -0,0 +1,56 @@
+#pragma once
+
+// Just enough of the Arduino API to build the library sources on the host
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#define PROGMEM
+#define PSTR(s) (s)
+#define pgm_read_byte(p) (*(const uint8_t *)(p))
+#define pgm_read_word(p) (*(const uint16_t *)(p))
+#define pgm_read_dword(p) (*(const uint32_t *)(p))
+#define pgm_read_ptr(p) (*(void * const *)(p))
+
+#define __DMB() __sync_synchronize()
+
+#define OUTPUT 1
+#define HIGH 1
+#define LOW 0
+
+inline void pinMode(uint8_t, uint8_t) {}
+inline void digitalWrite(uint8_t, uint8_t) {}
+inline int digitalRead(uint8_t) { return LOW; }
+
+unsigned long millis();
+unsigned long micros();
+
+class Print
+{
+public:
+    virtual ~Print() {}
+
+    virtual size_t write(uint8_t c) = 0;
+    virtual size_t write(const uint8_t *buf, size_t size)
+    {
+        size_t n = 0;
+        while (n < size && write(buf[n]))
+            n++;
+        return n;
+    }
+    size_t write(const char *str)
+    {
+        return write((const uint8_t *)str, strlen(str));
+    }
+    virtual int availableForWrite() { return 0; }
+    virtual void flush() {}
+};
+
+class Stream : public Print
+{
+public:
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int peek() = 0;
+};